@@ -0,0 +1,488 @@
+#include "pixel_sum/pixel_sum.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Construction throughput and query latency of PixelSum, reader latency of PixelSumSnapshots while frames are
+// published, and PixelSumBatch construction of many small patches, with warmup, repetitions and percentiles per case.
+//
+//   PixelSumBench [--repetitions=N] [--warmup=N] [--queries=N] [--threads=N] [--readers=N] [--sizes=WxH,...]
+//                 [--layouts=row_major,tiled,compact,fenwick,sparse] [--json=PATH] [--csv=PATH]
+//
+// A summary table goes to stdout; --json and --csv write every case for diffing between releases.
+
+namespace {
+struct Config {
+    int repetitions{10};
+    int warmup{2};
+    std::size_t queries{1U << 16};
+    unsigned int thread_count{1};
+    unsigned int readers{4};
+    std::vector<std::pair<int, int>> sizes{ { 256, 256 }, { 1024, 1024 }, { 4096, 4096 } };
+    std::vector<PixelSumLayout> layouts{ PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick };
+    std::string json_path;
+    std::string csv_path;
+};
+
+// One measured case: the per-repetition samples reduced to their distribution.
+struct Result {
+    std::string type;
+    std::string layout;
+    int width{0};
+    int height{0};
+    std::string metric;
+    std::string pattern;
+    std::string unit;
+    std::size_t repetitions{0};
+    double min{0.0};
+    double p50{0.0};
+    double p90{0.0};
+    double p99{0.0};
+    double max{0.0};
+    double mean{0.0};
+};
+
+const char* layoutName(PixelSumLayout layout)
+{
+    switch (layout) {
+    case PixelSumLayout::Tiled:
+        return "tiled";
+    case PixelSumLayout::Compact:
+        return "compact";
+    case PixelSumLayout::Fenwick:
+        return "fenwick";
+    case PixelSumLayout::Sparse:
+        return "sparse";
+    case PixelSumLayout::RowMajor:
+    default:
+        return "row_major";
+    }
+}
+
+// Nearest-rank percentile of sorted samples.
+double percentileOf(const std::vector<double>& sorted, double percentile)
+{
+    const auto rank = static_cast<std::size_t>(percentile / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+Result summarize(Result result, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    result.repetitions = samples.size();
+    result.min = samples.front();
+    result.p50 = percentileOf(samples, 50.0);
+    result.p90 = percentileOf(samples, 90.0);
+    result.p99 = percentileOf(samples, 99.0);
+    result.max = samples.back();
+    double sum = 0.0;
+    for (const double sample : samples) {
+        sum += sample;
+    }
+    result.mean = sum / static_cast<double>(samples.size());
+    return result;
+}
+
+// Runs `function` warmup times unmeasured, then returns the seconds of each measured repetition.
+template <typename Function>
+std::vector<double> measure(const Config& config, const Function& function)
+{
+    for (int i = 0; i < config.warmup; ++i) {
+        function();
+    }
+
+    std::vector<double> seconds;
+    seconds.reserve(static_cast<std::size_t>(config.repetitions));
+    for (int i = 0; i < config.repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const auto end = std::chrono::steady_clock::now();
+        seconds.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    return seconds;
+}
+
+template <typename T>
+std::vector<T> makePixels(int width, int height)
+{
+    std::mt19937 engine(7U);
+    std::uniform_int_distribution<int> value(0, std::numeric_limits<T>::max());
+    std::vector<T> pixels(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
+    for (auto& pixel : pixels) {
+        pixel = static_cast<T>(value(engine));
+    }
+    return pixels;
+}
+
+// Random windows anywhere in the image, a 16x16 window sliding in raster order, or the whole image.
+std::vector<PixelSumWindow> makeWindows(std::string_view pattern, int width, int height, std::size_t count)
+{
+    std::vector<PixelSumWindow> windows(count);
+    if (pattern == "random") {
+        std::mt19937 engine(11U);
+        std::uniform_int_distribution<int> x(0, width - 1);
+        std::uniform_int_distribution<int> y(0, height - 1);
+        for (auto& window : windows) {
+            window = PixelSumWindow{ x(engine), y(engine), x(engine), y(engine) };
+        }
+    } else if (pattern == "sequential") {
+        for (std::size_t i = 0; i < count; ++i) {
+            const int x = static_cast<int>(i % static_cast<std::size_t>(width));
+            const int y = static_cast<int>((i / static_cast<std::size_t>(width)) % static_cast<std::size_t>(height));
+            windows[i] = PixelSumWindow{ x, y, x + 15, y + 15 };
+        }
+    } else {
+        std::fill(windows.begin(), windows.end(), PixelSumWindow{ 0, 0, width - 1, height - 1 });
+    }
+    return windows;
+}
+
+template <typename T, typename S>
+void benchmarkType(const Config& config, const char* type, std::vector<Result>& results)
+{
+    // Keeps the optimizer from dropping the measured queries.
+    volatile S checksum{};
+
+    for (const auto& [width, height] : config.sizes) {
+        if (!PixelSum<T, S>::isRepresentable(width, height)) {
+            std::cerr << "skipping " << type << ' ' << width << 'x' << height << ": not representable\n";
+            continue;
+        }
+        const auto pixels = makePixels<T>(width, height);
+        const double megabytes = static_cast<double>(pixels.size() * sizeof(T)) / 1.0e6;
+
+        for (const PixelSumLayout layout : config.layouts) {
+            const PixelSumOptions options{ .thread_count = config.thread_count, .layout = layout };
+            const Result base{ type, layoutName(layout), width, height };
+
+            auto build_seconds = measure(config, [&] {
+                const PixelSum<T, S> pixel_sum(pixels.data(), width, height, options);
+                checksum = checksum + pixel_sum.getPixelSum(0, 0, 0, 0);
+            });
+            for (double& sample : build_seconds) {
+                sample = megabytes / sample;
+            }
+            Result build = base;
+            build.metric = "construction";
+            build.pattern = "full_image";
+            build.unit = "MB/s";
+            results.push_back(summarize(build, build_seconds));
+
+            const PixelSum<T, S> pixel_sum(pixels.data(), width, height, options);
+            for (const char* pattern : { "random", "sequential", "full_image" }) {
+                const auto windows = makeWindows(pattern, width, height, config.queries);
+                auto query_seconds = measure(config, [&] {
+                    S sum{};
+                    for (const auto& [x0, y0, x1, y1] : windows) {
+                        sum += pixel_sum.getPixelSum(x0, y0, x1, y1);
+                    }
+                    checksum = checksum + sum;
+                });
+                for (double& sample : query_seconds) {
+                    sample = sample * 1.0e9 / static_cast<double>(windows.size());
+                }
+                Result query = base;
+                query.metric = "getPixelSum";
+                query.pattern = pattern;
+                query.unit = "ns/query";
+                results.push_back(summarize(query, query_seconds));
+            }
+
+            // Means of 16x16 cells over the whole image, from one gridFilter() call and from one getter call per cell.
+            std::vector<double> means(pixel_sum.gridSize(16, 16));
+            const auto per_cell = static_cast<double>(means.size());
+            auto grid_seconds = measure(config, [&] {
+                pixel_sum.gridFilter(16, 16, PixelSumStatistic::Average, means);
+                checksum = checksum + static_cast<S>(means.back());
+            });
+            auto cell_seconds = measure(config, [&] {
+                std::size_t index = 0;
+                for (int y = 0; y < height; y += 16) {
+                    for (int x = 0; x < width; x += 16) {
+                        means[index++] = pixel_sum.getPixelAverage(x, y, x + 15, y + 15);
+                    }
+                }
+                checksum = checksum + static_cast<S>(means.back());
+            });
+            for (auto* seconds : { &grid_seconds, &cell_seconds }) {
+                for (double& sample : *seconds) {
+                    sample = sample * 1.0e9 / per_cell;
+                }
+            }
+            Result grid = base;
+            grid.metric = "grid_average";
+            grid.unit = "ns/cell";
+            grid.pattern = "gridFilter";
+            results.push_back(summarize(grid, grid_seconds));
+            grid.pattern = "per_cell";
+            results.push_back(summarize(grid, cell_seconds));
+        }
+    }
+}
+
+// Reader latency of PixelSumSnapshots with no writer ("idle") and while a writer publishes frames back to back
+// ("publishing"), against one PixelSum behind a mutex that the writer rebuilds in place ("mutex"). Every reader
+// pins a snapshot (or takes the lock) per query; each sample is the mean over a batch of kBatch queries, so the
+// high percentiles show the stalls readers hit during rebuilds.
+template <typename T, typename S>
+void benchmarkSnapshots(const Config& config, const char* type, std::vector<Result>& results)
+{
+    constexpr std::size_t kBatch = 64;
+    std::atomic<S> checksum{};
+
+    for (const auto& [width, height] : config.sizes) {
+        if (!PixelSum<T, S>::isRepresentable(width, height)) {
+            continue;
+        }
+        const auto pixels = makePixels<T>(width, height);
+        const auto windows = makeWindows("random", width, height, config.queries);
+
+        for (const PixelSumLayout layout : config.layouts) {
+            const PixelSumOptions options{ .thread_count = config.thread_count, .layout = layout };
+            const Result base{ type, layoutName(layout), width, height };
+
+            for (const std::string_view pattern : { "idle", "publishing", "mutex" }) {
+                std::vector<double> samples;
+                for (int repetition = -config.warmup; repetition < config.repetitions; ++repetition) {
+                    PixelSumSnapshots<T, S> live(pixels, width, height, options);
+                    PixelSum<T, S> locked(pixels, width, height, options);
+                    std::mutex mutex;
+                    std::atomic<bool> done{ false };
+
+                    std::thread writer([&] {
+                        while (pattern != "idle" && !done.load()) {
+                            if (pattern == "publishing") {
+                                live.publish(pixels, width, height);
+                            } else {
+                                const std::lock_guard lock(mutex);
+                                locked.rebuild(pixels);
+                            }
+                        }
+                    });
+
+                    std::vector<std::vector<double>> batches(config.readers);
+                    std::vector<std::thread> readers;
+                    for (unsigned int r = 0; r < config.readers; ++r) {
+                        readers.emplace_back([&, r] {
+                            auto reader = live.reader();
+                            S sum{};
+                            for (std::size_t begin = 0; begin < windows.size(); begin += kBatch) {
+                                const std::size_t end = std::min(begin + kBatch, windows.size());
+                                const auto start = std::chrono::steady_clock::now();
+                                for (std::size_t i = begin; i < end; ++i) {
+                                    const auto& [x0, y0, x1, y1] = windows[i];
+                                    if (pattern == "mutex") {
+                                        const std::lock_guard lock(mutex);
+                                        sum += locked.getPixelSum(x0, y0, x1, y1);
+                                    } else {
+                                        sum += reader.acquire()->getPixelSum(x0, y0, x1, y1);
+                                    }
+                                }
+                                const auto stop = std::chrono::steady_clock::now();
+                                batches[r].push_back(std::chrono::duration<double, std::nano>(stop - start).count() /
+                                                     static_cast<double>(end - begin));
+                            }
+                            checksum += sum;
+                        });
+                    }
+                    for (auto& reader : readers) {
+                        reader.join();
+                    }
+                    done = true;
+                    writer.join();
+
+                    if (repetition >= 0) {
+                        for (const auto& batch : batches) {
+                            samples.insert(samples.end(), batch.begin(), batch.end());
+                        }
+                    }
+                }
+
+                Result query = base;
+                query.metric = "reader_query";
+                query.pattern = std::string(pattern);
+                query.unit = "ns/query";
+                results.push_back(summarize(query, samples));
+            }
+        }
+    }
+}
+
+// Construction of 4096 patches of random sizes up to 64x64, cut out of one frame: one PixelSum per patch
+// ("individual", --threads per patch) against one PixelSumBatch (--threads over the patches) rebuilt in place.
+template <typename T, typename S>
+void benchmarkBatch(const Config& config, const char* type, std::vector<Result>& results)
+{
+    constexpr int kSide = 64;
+    constexpr std::size_t kPatches = 4096;
+    volatile S checksum{};
+
+    const auto pixels = makePixels<T>(1024, 1024);
+    const PixelSumImage<T> frame{ pixels.data(), 1024, 1024, 1024 };
+    std::mt19937 engine(13U);
+    std::uniform_int_distribution<int> side(8, kSide);
+    std::uniform_int_distribution<int> corner(0, 1024 - kSide);
+    std::vector<PixelSumImage<T>> patches(kPatches);
+    for (auto& patch : patches) {
+        patch = frame.roi(corner(engine), corner(engine), side(engine), side(engine));
+    }
+
+    const PixelSumOptions options{ .thread_count = config.thread_count };
+    auto individual_seconds = measure(config, [&] {
+        for (const auto& patch : patches) {
+            const PixelSum<T, S> pixel_sum(patch, options);
+            checksum = checksum + pixel_sum.getPixelSumUnchecked(0, 0, patch.width - 1, patch.height - 1);
+        }
+    });
+    PixelSumBatch<T, S> batch(patches, config.thread_count);
+    auto batch_seconds = measure(config, [&] {
+        batch.rebuild(patches);
+        checksum = checksum + batch[kPatches - 1].getPixelSumUnchecked(0, 0, 0, 0);
+    });
+    for (auto* seconds : { &individual_seconds, &batch_seconds }) {
+        for (double& sample : *seconds) {
+            sample = sample * 1e9 / static_cast<double>(kPatches);
+        }
+    }
+
+    Result build{ type, "row_major", kSide, kSide };
+    build.metric = "patch_build";
+    build.unit = "ns/patch";
+    build.pattern = "individual";
+    results.push_back(summarize(build, individual_seconds));
+    build.pattern = "batch";
+    results.push_back(summarize(build, batch_seconds));
+}
+
+void writeJson(const std::vector<Result>& results, std::ostream& out)
+{
+    out << "[\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "  {\"type\": \"" << r.type << "\", \"layout\": \"" << r.layout << "\", \"width\": " << r.width
+            << ", \"height\": " << r.height << ", \"metric\": \"" << r.metric << "\", \"pattern\": \"" << r.pattern
+            << "\", \"unit\": \"" << r.unit << "\", \"repetitions\": " << r.repetitions << ", \"min\": " << r.min
+            << ", \"p50\": " << r.p50 << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99 << ", \"max\": " << r.max
+            << ", \"mean\": " << r.mean << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "]\n";
+}
+
+void writeCsv(const std::vector<Result>& results, std::ostream& out)
+{
+    out << "type,layout,width,height,metric,pattern,unit,repetitions,min,p50,p90,p99,max,mean\n";
+    for (const Result& r : results) {
+        out << r.type << ',' << r.layout << ',' << r.width << ',' << r.height << ',' << r.metric << ',' << r.pattern << ','
+            << r.unit << ',' << r.repetitions << ',' << r.min << ',' << r.p50 << ',' << r.p90 << ',' << r.p99 << ','
+            << r.max << ',' << r.mean << '\n';
+    }
+}
+
+void writeTable(const std::vector<Result>& results, std::ostream& out)
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-6s %-9s %11s %-12s %-10s %12s %12s %12s %-8s\n", "type", "layout", "size", "metric",
+                  "pattern", "p50", "p90", "p99", "unit");
+    out << line;
+    for (const Result& r : results) {
+        const std::string size = std::to_string(r.width) + 'x' + std::to_string(r.height);
+        std::snprintf(line, sizeof(line), "%-6s %-9s %11s %-12s %-10s %12.2f %12.2f %12.2f %-8s\n", r.type.c_str(),
+                      r.layout.c_str(), size.c_str(), r.metric.c_str(), r.pattern.c_str(), r.p50, r.p90, r.p99, r.unit.c_str());
+        out << line;
+    }
+}
+
+bool parseArguments(int argc, char* argv[], Config& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view argument(argv[i]);
+        const auto equals = argument.find('=');
+        const std::string_view name = argument.substr(0, equals);
+        const std::string value(equals == std::string_view::npos ? std::string_view{} : argument.substr(equals + 1));
+
+        if (name == "--repetitions") {
+            config.repetitions = std::max(1, std::atoi(value.c_str()));
+        } else if (name == "--warmup") {
+            config.warmup = std::max(0, std::atoi(value.c_str()));
+        } else if (name == "--queries") {
+            config.queries = static_cast<std::size_t>(std::max(1, std::atoi(value.c_str())));
+        } else if (name == "--threads") {
+            config.thread_count = static_cast<unsigned int>(std::max(0, std::atoi(value.c_str())));
+        } else if (name == "--readers") {
+            config.readers = static_cast<unsigned int>(std::max(1, std::atoi(value.c_str())));
+        } else if (name == "--sizes") {
+            config.sizes.clear();
+            std::istringstream list(value);
+            std::string size;
+            while (std::getline(list, size, ',')) {
+                const auto x = size.find('x');
+                if (x == std::string::npos) {
+                    return false;
+                }
+                config.sizes.emplace_back(std::atoi(size.substr(0, x).c_str()), std::atoi(size.substr(x + 1).c_str()));
+            }
+        } else if (name == "--layouts") {
+            config.layouts.clear();
+            std::istringstream list(value);
+            std::string layout;
+            while (std::getline(list, layout, ',')) {
+                const PixelSumLayout all[] = { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact,
+                                               PixelSumLayout::Fenwick, PixelSumLayout::Sparse };
+                const auto* match = std::find_if(std::begin(all), std::end(all), [&](PixelSumLayout l) { return layout == layoutName(l); });
+                if (match == std::end(all)) {
+                    return false;
+                }
+                config.layouts.push_back(*match);
+            }
+        } else if (name == "--json") {
+            config.json_path = value;
+        } else if (name == "--csv") {
+            config.csv_path = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Config config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "usage: PixelSumBench [--repetitions=N] [--warmup=N] [--queries=N] [--threads=N] [--readers=N] [--sizes=WxH,...]\n"
+                     "                     [--layouts=row_major,tiled,compact,fenwick,sparse] [--json=PATH] [--csv=PATH]\n";
+        return 1;
+    }
+
+    std::vector<Result> results;
+    benchmarkType<std::uint8_t, std::uint32_t>(config, "u8", results);
+    benchmarkType<std::uint16_t, std::uint64_t>(config, "u16", results);
+    benchmarkSnapshots<std::uint8_t, std::uint32_t>(config, "u8", results);
+    benchmarkBatch<std::uint8_t, std::uint32_t>(config, "u8", results);
+
+    writeTable(results, std::cout);
+    if (!config.json_path.empty()) {
+        std::ofstream json(config.json_path);
+        writeJson(results, json);
+    }
+    if (!config.csv_path.empty()) {
+        std::ofstream csv(config.csv_path);
+        writeCsv(results, csv);
+    }
+    return 0;
+}
@@ -1,18 +1,237 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <iosfwd>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// Builds the library with the usage counters below (-DPIXEL_SUM_ENABLE_STATS=ON in CMake). When 0, every hook
+// compiles away and the counters read as 0.
+#ifndef PIXEL_SUM_ENABLE_STATS
+#define PIXEL_SUM_ENABLE_STATS 0
+#endif
+
+enum class PixelSumLayout {
+    // One row-major vector per integral image.
+    RowMajor,
+    // Page-sized tiles holding the sum and non-zero entries of each pixel side by side, so a corner costs one
+    // cache line and nearby corners share a page.
+    Tiled,
+    // Narrow block-local sums (16-bit in 16x16 blocks for 8-bit pixels, 32-bit in 32x32 blocks for 16-bit ones) plus
+    // full-width block bases, at the cost of two extra adds per corner. PixelSumU8 takes about 5/8 of the RowMajor
+    // memory (1.6x less), PixelSumU16 about 7/16 (2.3x less).
+    Compact,
+    // 2D Fenwick trees instead of integral images: O(log W * log H) corners, but an update costs
+    // O(log W * log H) per changed pixel instead of touching everything below and right of it.
+    Fenwick,
+    // Only the non-zero pixels, in a Fenwick tree over rows whose nodes keep their pixels sorted by column with
+    // running sums: memory grows with the non-zero count (times about log2(H) / 2) instead of W * H, and a corner
+    // costs O(log H * log N). Meant for masks with a few percent of non-zero pixels or less; no updates.
+    Sparse,
+    // Sparse when a sample of the rows says it takes under a quarter of the RowMajor memory, else RowMajor.
+    // Decided once by the constructor; rebuild() keeps the choice.
+    Auto,
+};
+
+// Bit mask of the tables of PixelSum. PixelSumOptions::tables picks among the two integral images (All is both);
+// the optional tables are requested through their own options and tracked here for lazy construction.
+enum class PixelSumTables : unsigned int {
+    None = 0,
+    // Behind getPixelSum() and getPixelAverage().
+    Sum = 1U << 0,
+    // Behind getNonZeroCount().
+    NonZero = 1U << 1,
+    All = Sum | NonZero,
+    // PixelSumOptions::with_squares, behind the variance getters.
+    Squares = 1U << 2,
+    // PixelSumOptions::with_rotated, behind getRotatedSum().
+    Rotated = 1U << 3,
+    // PixelSumOptions::histogram_bins or histogram_edges, behind getHistogram() and getPercentile().
+    Histogram = 1U << 4,
+};
+
+[[nodiscard]] constexpr PixelSumTables operator|(PixelSumTables lhs, PixelSumTables rhs) noexcept
+{
+    return static_cast<PixelSumTables>(static_cast<unsigned int>(lhs) | static_cast<unsigned int>(rhs));
+}
+
+[[nodiscard]] constexpr PixelSumTables operator&(PixelSumTables lhs, PixelSumTables rhs) noexcept
+{
+    return static_cast<PixelSumTables>(static_cast<unsigned int>(lhs) & static_cast<unsigned int>(rhs));
+}
+
+[[nodiscard]] constexpr PixelSumTables operator~(PixelSumTables tables) noexcept
+{
+    constexpr auto kEvery = PixelSumTables::All | PixelSumTables::Squares | PixelSumTables::Rotated | PixelSumTables::Histogram;
+    return static_cast<PixelSumTables>(~static_cast<unsigned int>(tables) & static_cast<unsigned int>(kEvery));
+}
+
+struct PixelSumOptions {
+    // Threads used to build the integral images; 0 uses every hardware thread.
+    unsigned int thread_count{1};
+    PixelSumLayout layout{PixelSumLayout::RowMajor};
+    // Also build a 64-bit integral image of squared pixels for the variance getters.
+    bool with_squares{false};
+    // Also build the 45-degree rotated tables behind getRotatedSum().
+    bool with_rotated{false};
+    // Equal-width bins over the pixel range for getHistogram() and getPercentile(); 0 builds no histogram.
+    unsigned int histogram_bins{0};
+    // Explicit bins instead: the ascending first pixel values of bins 1, 2, ... (bin 0 starts at 0, the last bin
+    // ends at the largest pixel value). Cannot be combined with histogram_bins.
+    std::vector<std::uint32_t> histogram_edges{};
+    // Integral images to build (Sum, NonZero or All); getters needing a missing one throw, and updates need Sum. The
+    // Tiled, Compact and Fenwick layouts interleave both tables, so they always build both.
+    PixelSumTables tables{PixelSumTables::All};
+    // Build each table, the optional ones above included, on the first query that needs it instead of in the
+    // constructor (safe with concurrent readers), so a table that is never queried is never built. The source pixels
+    // are read then, so they must stay valid and unchanged until the object is rebuilt or destroyed, or until every
+    // requested table has been queried. An update builds every table first.
+    bool lazy{false};
+};
+
+struct PixelSumWindow {
+    int x0{0};
+    int y0{0};
+    int x1{0};
+    int y1{0};
+};
+
+// Pixels read in place from a row-padded buffer or a region of a larger image: `height` rows of `width` pixels,
+// the first starting at `data`, consecutive rows `stride` elements apart.
+template <typename T>
+struct PixelSumImage {
+    const T* data{nullptr};
+    int width{0};
+    int height{0};
+    std::size_t stride{0};
+
+    // Image whose rows are `pitch_bytes` apart, as reported by most capture APIs.
+    [[nodiscard]] static PixelSumImage fromPitch(const T* data, int width, int height, std::size_t pitch_bytes)
+    {
+        if (pitch_bytes % sizeof(T) != 0) {
+            throw std::runtime_error("Row pitch is not a whole number of pixels");
+        }
+        return PixelSumImage{ data, width, height, pitch_bytes / sizeof(T) };
+    }
+
+    // The w x h region of interest whose top-left pixel is (x, y); it must lie inside this image.
+    [[nodiscard]] PixelSumImage roi(int x, int y, int w, int h) const
+    {
+        if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > width - x || h > height - y) {
+            throw std::runtime_error("Region of interest is out of bound");
+        }
+        return PixelSumImage{ row(y) + x, w, h, stride };
+    }
+
+    [[nodiscard]] const T* row(int y) const noexcept { return data + static_cast<std::size_t>(y) * stride; }
+};
+
+// Per-window value written by PixelSum::boxFilter().
+enum class PixelSumStatistic {
+    Sum,
+    NonZeroCount,
+    Average,
+    NonZeroAverage,
+};
+
+template <typename S>
+struct PixelSumStats {
+    S sum{};
+    S nonzero_count{};
+    double pixel_average{0.0};
+    double nonzero_average{0.0};
+};
+
+// Usage counters of every PixelSum in the process, summed over the per-thread counters when read.
+struct PixelSumCounters {
+    std::uint64_t sum_queries{0};
+    std::uint64_t nonzero_count_queries{0};
+    std::uint64_t average_queries{0};
+    std::uint64_t nonzero_average_queries{0};
+    // Variance and standard deviation queries, of all pixels and of the non-zero pixels.
+    std::uint64_t variance_queries{0};
+    std::uint64_t nonzero_variance_queries{0};
+    std::uint64_t histogram_queries{0};
+    std::uint64_t percentile_queries{0};
+    std::uint64_t rotated_queries{0};
+    // Windows passed to getWindowStats().
+    std::uint64_t batch_windows{0};
+    // Windows cut at the image border, and windows entirely outside the image, over all clamping getters; a rotated
+    // window counts by its bounding box.
+    std::uint64_t clamped_windows{0};
+    std::uint64_t empty_windows{0};
+    // Constructions and rebuilds, their total wall time and the table bytes they produced.
+    std::uint64_t builds{0};
+    std::uint64_t build_nanoseconds{0};
+    std::uint64_t build_bytes{0};
+    // Instances alive right now and the table bytes they hold; not affected by resetPixelSumCounters().
+    std::uint64_t live_instances{0};
+    std::uint64_t live_bytes{0};
+};
+
+[[nodiscard]] constexpr bool pixelSumStatsEnabled() noexcept { return PIXEL_SUM_ENABLE_STATS != 0; }
+// Snapshot of the counters; threads still querying may be counted partially.
+[[nodiscard]] PixelSumCounters pixelSumCounters();
+// Restarts every counter except the live ones from 0.
+void resetPixelSumCounters();
+// Writes one "pixel_sum_<counter> <value>" line per counter (Prometheus text exposition format).
+void writePixelSumCounters(std::ostream& out, const PixelSumCounters& counters);
+
+// What one PixelSum holds: table bytes owned by the object (mapped table files excluded), and the wall time of its
+// last build (0 without PIXEL_SUM_ENABLE_STATS).
+struct PixelSumInstanceStats {
+    std::uint64_t bytes{0};
+    std::uint64_t build_nanoseconds{0};
+};
+
+// Keeps PixelSumCounters::live_instances and live_bytes in step with the PixelSum holding it; empty, and free,
+// without PIXEL_SUM_ENABLE_STATS.
+class PixelSumLiveStats {
+public:
+#if PIXEL_SUM_ENABLE_STATS
+    PixelSumLiveStats() noexcept;
+    ~PixelSumLiveStats();
+    PixelSumLiveStats(const PixelSumLiveStats& other) noexcept;
+    PixelSumLiveStats(PixelSumLiveStats&& other) noexcept;
+    PixelSumLiveStats& operator=(const PixelSumLiveStats& other) noexcept;
+    PixelSumLiveStats& operator=(PixelSumLiveStats&& other) noexcept;
+
+    void track(std::uint64_t bytes) noexcept;
+    void recordBuild(std::uint64_t nanoseconds) noexcept { build_nanoseconds_ = nanoseconds; }
+    [[nodiscard]] std::uint64_t buildNanoseconds() const noexcept { return build_nanoseconds_; }
+
+private:
+    std::uint64_t bytes_{0};
+    std::uint64_t build_nanoseconds_{0};
+#else
+    void track(std::uint64_t /*bytes*/) noexcept {}
+    void recordBuild(std::uint64_t /*nanoseconds*/) noexcept {}
+    [[nodiscard]] std::uint64_t buildNanoseconds() const noexcept { return 0; }
+#endif
+};
+
 template <typename T, typename S>
 class PixelSum {
-    static constexpr int kMaxWidth = 4096;
-    static constexpr int kMaxHeight = 4096;
-
 public:
     explicit PixelSum(const T* buffer, int width, int height);
     explicit PixelSum(std::span<const T> buffer, int width, int height);
+    explicit PixelSum(const T* buffer, int width, int height, const PixelSumOptions& options);
+    explicit PixelSum(std::span<const T> buffer, int width, int height, const PixelSumOptions& options);
+    // Build from a pitched image or region of interest, reading the pixels in place; no packed copy is made.
+    explicit PixelSum(const PixelSumImage<T>& image);
+    explicit PixelSum(const PixelSumImage<T>& image, const PixelSumOptions& options);
 
     ~PixelSum() = default;
     PixelSum(const PixelSum&) = default;
@@ -20,26 +239,665 @@ public:
     PixelSum& operator=(const PixelSum&) = default;
     PixelSum& operator=(PixelSum&&) noexcept = default;
 
+    // Rebuilds the tables from a new image, keeping the options (a lazy object reads the new pixels later), and drops
+    // any staged updates. Storage is reused, so rebuilding single-threaded at the same (or a smaller) size allocates
+    // nothing; a parallel rebuild still starts its threads. For double buffering, rebuild a second object while the
+    // first is queried, then std::swap them.
+    void rebuild(std::span<const T> buffer);
+    void rebuild(std::span<const T> buffer, int width, int height);
+    void rebuild(const PixelSumImage<T>& image);
+
     [[nodiscard]] S getPixelSum(int x0, int y0, int x1, int y1) const;
     [[nodiscard]] double getPixelAverage(int x0, int y0, int x1, int y1) const;
     [[nodiscard]] S getNonZeroCount(int x0, int y0, int x1, int y1) const;
     [[nodiscard]] double getNonZeroAverage(int x0, int y0, int x1, int y1) const;
 
+    // The four getters above without normalization or clamping, for callers that guarantee
+    // 0 <= x0 <= x1 < width and 0 <= y0 <= y1 < height; other coordinates are undefined behaviour.
+    [[nodiscard]] S getPixelSumUnchecked(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getPixelAverageUnchecked(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] S getNonZeroCountUnchecked(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getNonZeroAverageUnchecked(int x0, int y0, int x1, int y1) const;
+
+    // Population variance and standard deviation of the window's pixels, or of its non-zero pixels only (0 when
+    // there are none). Require PixelSumOptions::with_squares.
+    [[nodiscard]] double getPixelVariance(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getPixelStdDev(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getNonZeroVariance(int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getNonZeroStdDev(int x0, int y0, int x1, int y1) const;
+
+    // Sum of the 2 * w * h pixels of the rectangle rotated by 45 degrees whose top pixel is (x, y) and whose edges
+    // run w pixels down-right and h pixels down-left (as in tilted Haar features). Pixels outside the image count
+    // as 0, so the window may hang over any edge. Requires PixelSumOptions::with_rotated.
+    [[nodiscard]] S getRotatedSum(int x, int y, int w, int h) const;
+
+    // Pixel counts of the window per histogram bin, clamped like the getters; `histogram` needs at least
+    // getHistogramEdges().size() - 1 entries.
+    void getHistogram(int x0, int y0, int x1, int y1, std::span<S> histogram) const;
+    // Approximate percentile (0 to 100) of the window's pixels, interpolated linearly inside the bin it falls in;
+    // 0 for windows outside the image.
+    [[nodiscard]] double getPercentile(int x0, int y0, int x1, int y1, double percentile) const;
+    // First pixel value of every bin, followed by one past the largest pixel value; empty without a histogram.
+    [[nodiscard]] std::span<const std::uint32_t> getHistogramEdges() const noexcept { return histogram_edges_; }
+
+    // Fills results[i] with what the four getters above return for windows[i].
+    void getWindowStats(std::span<const PixelSumWindow> windows, std::span<PixelSumStats<S>> results) const;
+
+    // Fills the row-major width x height output with the statistic of the (2 * radius + 1)^2 window centred on every
+    // pixel, clamped at the borders exactly like the getters. Rows are split across PixelSumOptions::thread_count.
+    // Row buffers are kept per thread, so repeating a single-threaded filter allocates nothing.
+    // The S overload only accepts Sum and NonZeroCount.
+    void boxFilter(int radius, PixelSumStatistic statistic, std::span<double> output) const;
+    void boxFilter(int radius, PixelSumStatistic statistic, std::span<S> output) const;
+
+    // Fills the output with the statistic of every cell of a grid of cell_width x cell_height cells anchored at the
+    // top-left pixel, row-major. The last column and row of cells are clipped to the image like the getters clamp,
+    // and averages divide by the clipped area. With levels > 1 the cells double in both directions per level (a
+    // coarse pyramid), each level following the previous one. Nothing is allocated. The S overload only accepts
+    // Sum and NonZeroCount.
+    void gridFilter(int cell_width, int cell_height, PixelSumStatistic statistic, std::span<double> output, int levels = 1) const;
+    void gridFilter(int cell_width, int cell_height, PixelSumStatistic statistic, std::span<S> output, int levels = 1) const;
+    // Output entries gridFilter() needs for these arguments.
+    [[nodiscard]] std::size_t gridSize(int cell_width, int cell_height, int levels = 1) const;
+
+    // Replaces the pixels of the window (inclusive, normalized like the getters, must lie inside the image) with
+    // the row-major `pixels` and patches the tables; only entries below and right of the window's top-left change.
+    void update(int x0, int y0, int x1, int y1, std::span<const T> pixels);
+    // Same as update(), but only stages the pixels. Staged updates are merged and applied in one pass by
+    // flushUpdates() or by the next query, so call flushUpdates() before sharing the object between threads.
+    void deferUpdate(int x0, int y0, int x1, int y1, std::span<const T> pixels);
+    void flushUpdates();
+
+    // Writes the integral images of PixelSumOptions::tables and the dimensions to a versioned table file, row-major
+    // whatever the layout.
+    void save(const std::filesystem::path& path) const;
+    // Maps a table file written by save() for the same T and S, with the tables that were saved. Queries read the
+    // mapped pages directly, so processes loading the same file share its memory; the tables are copied into private
+    // memory on the first update. The result uses PixelSumLayout::RowMajor and has no sum-of-squares table.
+    [[nodiscard]] static PixelSum load(const std::filesystem::path& path);
+
     explicit operator bool() const noexcept;
 
+    [[nodiscard]] PixelSumInstanceStats instanceStats() const noexcept;
+
+    // True when every window sum of a width x height image fits in S, i.e. the dimensions are accepted by the
+    // constructors. Use it to fall back to a wider accumulator (e.g. PixelSumU8Wide) for large images.
+    [[nodiscard]] static bool isRepresentable(int width, int height) noexcept;
+
 private:
+    enum class Table { Sum, NonZero };
+
+    // Read-only RowMajor tables of a file opened by load().
+    struct MappedTables;
+
+    // Block-local sums of PixelSumLayout::Compact; the non-zero counts of a block always fit in 16 bits.
+    using CompactSum = std::conditional_t<sizeof(T) == 1, std::uint16_t, std::uint32_t>;
+
     int width_{0};
     int height_{0};
+    PixelSumLayout layout_{PixelSumLayout::RowMajor};
+    bool with_squares_{false};
+    bool with_rotated_{false};
+    bool build_lazily_{false};
+    unsigned int thread_count_{1};
 
-    std::vector<T> pixel_data_{};
     std::vector<S> nonzero_data_{};
     std::vector<S> summed_data_{};
+    std::vector<S> tiled_data_{};
+    std::vector<S> compact_base_{};
+    std::vector<CompactSum> compact_sum_{};
+    std::vector<std::uint16_t> compact_nonzero_{};
+    // [sum, nonzero] pairs of the Fenwick trees, row-major.
+    std::vector<S> fenwick_data_{};
+    // PixelSumLayout::Sparse: node i of the row Fenwick tree holds sparse_entries_[sparse_offsets_[i],
+    // sparse_offsets_[i + 1]), sorted by column, with the sum and non-zero count of the node's pixels up to and
+    // including each entry's column.
+    struct SparseEntry {
+        int column;
+        S sum;
+        S nonzero;
+    };
+    std::vector<std::size_t> sparse_offsets_{};
+    std::vector<SparseEntry> sparse_entries_{};
+    // The optional tables below stay empty in a lazy object until the first query that reads them.
+    // Row-major integral image of squared pixels, whatever the layout; empty unless PixelSumOptions::with_squares.
+    std::vector<std::uint64_t> squares_data_{};
+    // Row-major sums of the 45-degree cones with their apex on each pixel, plus the two diagonal prefix sums the
+    // cones outside the image reduce to; empty unless PixelSumOptions::with_rotated.
+    std::vector<S> rotated_data_{};
+    std::vector<S> rotated_diagonals_{};
+    // Integral histograms: the per-bin pixel counts of every prefix window, bin-interleaved and row-major, in
+    // 32-bit counters whatever S is. Empty unless a histogram was requested.
+    std::vector<std::uint32_t> histogram_data_{};
+    std::vector<std::uint32_t> histogram_edges_{};
+    // Bin index of every pixel value.
+    std::vector<std::uint16_t> histogram_bin_of_{};
+    // Per-bin counts of the row being accumulated, reused by every build and update.
+    std::vector<std::uint32_t> histogram_running_{};
+    // Integral images requested by PixelSumOptions::tables, built or still pending.
+    PixelSumTables tables_{PixelSumTables::All};
+    // When set, the RowMajor tables live in this mapping instead of summed_data_ and nonzero_data_.
+    std::shared_ptr<const MappedTables> mapping_{};
+    // Row staging of the Tiled and Compact sinks, one slice per build strip, and of the rotated cone rows.
+    std::vector<S> scratch_{};
 
+    // Pixel deltas staged by deferUpdate(), row-major over their bounding box; empty when region.x0 > region.x1.
+    struct DeferredUpdates {
+        PixelSumWindow region{0, 0, -1, -1};
+        std::vector<S> sum{};
+        std::vector<S> nonzero{};
+        std::vector<std::uint64_t> squares{};
+        // Bin count deltas, bin-interleaved.
+        std::vector<std::uint32_t> histogram{};
+    };
+    DeferredUpdates deferred_{};
+
+    // Source pixels and tables not built yet of a lazy object. Readers check `pending` without locking; the first
+    // one that needs a pending table builds it under `mutex`. Copies get their own mutex, moves take the work along.
+    struct LazyBuild {
+        PixelSumImage<T> source{};
+        std::atomic<PixelSumTables> pending{PixelSumTables::None};
+        std::mutex mutex{};
+
+        LazyBuild() = default;
+        ~LazyBuild() = default;
+        LazyBuild(const LazyBuild& other) noexcept
+            : source(other.source)
+            , pending(other.pending.load())
+        {
+        }
+        LazyBuild(LazyBuild&& other) noexcept
+            : source(other.source)
+            , pending(other.pending.exchange(PixelSumTables::None))
+        {
+        }
+        LazyBuild& operator=(const LazyBuild& other) noexcept
+        {
+            source = other.source;
+            pending.store(other.pending.load());
+            return *this;
+        }
+        LazyBuild& operator=(LazyBuild&& other) noexcept
+        {
+            if (this != &other) {
+                source = other.source;
+                pending.store(other.pending.exchange(PixelSumTables::None));
+            }
+            return *this;
+        }
+    };
+    mutable LazyBuild lazy_{};
+    [[no_unique_address]] PixelSumLiveStats live_stats_{};
+
+    PixelSum() = default;
+
+    // View of a tightly packed buffer, checked to hold width * height pixels.
+    [[nodiscard]] static PixelSumImage<T> packedImage(std::span<const T> buffer, int width, int height);
     static void normalizeBounds(int& x0, int& y0, int& x1, int& y1);
     [[nodiscard]] bool clampBounds(int& x0, int& y0, int& x1, int& y1) const;
+    [[nodiscard]] std::uint64_t ownedBytes() const noexcept;
     [[nodiscard]] static std::size_t indexOf(int x, int y, int width) noexcept;
-    [[nodiscard]] S getSummedArea(std::span<const S> data, int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] S getSummedArea(Table table, int x0, int y0, int x1, int y1) const;
+    // Sum of squared pixels of a normalized, clamped window; the squares table must exist.
+    [[nodiscard]] std::uint64_t getSquaresSum(int x0, int y0, int x1, int y1) const noexcept;
+    // Cone sum with the apex at (x, y), anywhere on or off the image.
+    [[nodiscard]] S rotatedCone(long long x, long long y) const noexcept;
+    // getHistogram() without the query counter, shared with getPercentile().
+    void histogramOf(int x0, int y0, int x1, int y1, std::span<S> histogram) const;
+    void flushDeferred() const;
+    // Throws unless every table in `needed` was requested, and builds the ones still pending.
+    void ensureTables(PixelSumTables needed) const;
+    // Builds the integral images in `tables` (both for the interleaved layouts), plus the squares table in the same
+    // pass when `squares` is non-empty.
+    void buildTables(const PixelSumImage<T>& source, PixelSumTables tables, std::span<std::uint64_t> squares);
+    void buildSquares(const PixelSumImage<T>& source);
+    // Builds the integral images and optional tables in `tables`.
+    void buildParts(const PixelSumImage<T>& source, PixelSumTables tables);
+    // The optional tables requested by the options, as PixelSumTables bits.
+    [[nodiscard]] PixelSumTables optionalTables() const noexcept;
+    // Row-major table of the mapping or of this object; null when the table has not been built.
+    [[nodiscard]] const S* rowMajorTable(Table table) const noexcept;
+    void detachMapping();
+    void configureHistogram(const PixelSumOptions& options);
+    void buildHistogram(const PixelSumImage<T>& source);
+    [[nodiscard]] std::size_t histogramBins() const noexcept;
+    // The three row buffers of the rotated cone recurrence, taken from scratch_.
+    [[nodiscard]] std::span<S> coneRows();
+    void readRow(int y, S* sum, S* nonzero) const;
+    void buildFenwick(const PixelSumImage<T>& source);
+    void buildSparse(const PixelSumImage<T>& source);
+    // Resolves PixelSumLayout::Auto from the density of a sample of the rows of `image`.
+    [[nodiscard]] static PixelSumLayout autoLayout(const PixelSumImage<T>& image) noexcept;
+
+    // Call function(read) with read(x, y) returning the integral image entry of one table, or read(x, y, corner)
+    // filling corner[0] and corner[1] with the sum and non-zero entries, for the active layout.
+    template <typename Function>
+    decltype(auto) withTableReader(Table table, const Function& function) const;
+    template <typename Function>
+    decltype(auto) withCornerReader(const Function& function) const;
+    // Call function(make_sink) with a factory make_sink(strip) of row sinks writing the tables of the active
+    // (integral image) layout, for strips 0 to strips - 1. RowMajor sinks only store the tables in `tables`.
+    template <typename Function>
+    decltype(auto) withSinkFactory(unsigned int strips, PixelSumTables tables, const Function& function);
+
+    // Call store(y, sum, nonzero, rows) for every image row with the window sums and non-zero counts of the row's
+    // pixels; only the tables named by with_sum / with_nonzero are filled. rows is the clamped window height.
+    template <typename Store>
+    void filterWindows(int radius, bool with_sum, bool with_nonzero, const Store& store) const;
+    // Call store(index, sum, nonzero, area) for every cell of every gridFilter() level in output order; only the
+    // tables named by with_sum / with_nonzero are read.
+    template <typename Store>
+    void gridWindows(int cell_width, int cell_height, int levels, bool with_sum, bool with_nonzero, const Store& store) const;
+
+    template <typename CornerReader>
+    void gatherWindowStats(std::span<const PixelSumWindow> windows,
+                           std::span<PixelSumStats<S>> results,
+                           const CornerReader& read_corner) const;
 };
 
 using PixelSumU8 = PixelSum<std::uint8_t, std::uint32_t>;
 using PixelSumU16 = PixelSum<std::uint16_t, std::uint64_t>;
+using PixelSumU8Wide = PixelSum<std::uint8_t, std::uint64_t>;
+
+// Builds the same integral images as PixelSum one row at a time, for line-scan sources that never hold a whole
+// frame. Rows are numbered from 0 in arrival order, and a window may be queried as soon as its rows have arrived;
+// rows that have not arrived yet are clamped away like rows outside the image.
+template <typename T, typename S>
+class PixelSumStream {
+public:
+    // With capacity 0 every row is kept; otherwise only the last `capacity` rows can be queried, so memory stays
+    // bounded on endless strips. Throws if a window of width x capacity pixels could overflow S.
+    explicit PixelSumStream(int width, int capacity = 0);
+
+    // Appends the next row; `row` must hold at least width() pixels.
+    void pushRow(std::span<const T> row);
+
+    [[nodiscard]] int width() const noexcept { return width_; }
+    // Number of rows pushed so far.
+    [[nodiscard]] std::int64_t rows() const noexcept { return rows_; }
+    // Oldest row still queryable; windows reaching above it throw.
+    [[nodiscard]] std::int64_t firstRow() const noexcept;
+
+    [[nodiscard]] S getPixelSum(int x0, std::int64_t y0, int x1, std::int64_t y1) const;
+    [[nodiscard]] double getPixelAverage(int x0, std::int64_t y0, int x1, std::int64_t y1) const;
+    [[nodiscard]] S getNonZeroCount(int x0, std::int64_t y0, int x1, std::int64_t y1) const;
+    [[nodiscard]] double getNonZeroAverage(int x0, std::int64_t y0, int x1, std::int64_t y1) const;
+
+private:
+    int width_{0};
+    int capacity_{0};
+    std::int64_t rows_{0};
+    // [sum row | nonzero row] per stored row. In ring mode there are capacity + 1 slots, so the row above the
+    // oldest queryable row is still there.
+    std::vector<S> data_{};
+
+    // Index of the stored [sum | nonzero] row y in data_.
+    [[nodiscard]] std::size_t offsetOf(std::int64_t y) const noexcept;
+    [[nodiscard]] bool clampBounds(int& x0, std::int64_t& y0, int& x1, std::int64_t& y1) const;
+    // Window sum of the sum table (offset 0) or the non-zero table (offset width_) over clamped bounds.
+    [[nodiscard]] S getSummedArea(std::size_t offset, int x0, std::int64_t y0, int x1, std::int64_t y1) const;
+};
+
+using PixelSumStreamU8 = PixelSumStream<std::uint8_t, std::uint32_t>;
+using PixelSumStreamU16 = PixelSumStream<std::uint16_t, std::uint64_t>;
+using PixelSumStreamU8Wide = PixelSumStream<std::uint8_t, std::uint64_t>;
+
+// Per-channel integral images of an interleaved multi-channel image (RGB, RGBA, ...), built in one pass without
+// de-interleaving. The tables are interleaved too, so a window reads the entries of every channel at each corner
+// as one contiguous run.
+template <typename T, typename S>
+class PixelSumChannels {
+public:
+    // `buffer` holds width * height pixels of `channels` consecutive values each.
+    explicit PixelSumChannels(const T* buffer, int width, int height, int channels);
+    explicit PixelSumChannels(std::span<const T> buffer, int width, int height, int channels);
+
+    [[nodiscard]] int width() const noexcept { return width_; }
+    [[nodiscard]] int height() const noexcept { return height_; }
+    [[nodiscard]] int channels() const noexcept { return channels_; }
+
+    // The PixelSum getters for one channel; windows are normalized and clamped the same way.
+    [[nodiscard]] S getPixelSum(int channel, int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getPixelAverage(int channel, int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] S getNonZeroCount(int channel, int x0, int y0, int x1, int y1) const;
+    [[nodiscard]] double getNonZeroAverage(int channel, int x0, int y0, int x1, int y1) const;
+
+    // Fills stats[c] for every channel c from a single read of the four corners; needs channels() entries.
+    void getChannelStats(int x0, int y0, int x1, int y1, std::span<PixelSumStats<S>> stats) const;
+
+private:
+    int width_{0};
+    int height_{0};
+    int channels_{0};
+    // (width + 1) x (height + 1) entries of 2 * channels values, row-major: the channel sums, then the channel
+    // non-zero counts. The top row and left column are zero, so corners need no edge cases.
+    std::vector<S> data_{};
+
+    [[nodiscard]] std::size_t stride() const noexcept { return 2 * static_cast<std::size_t>(channels_); }
+    void checkChannel(int channel) const;
+    [[nodiscard]] bool clampBounds(int& x0, int& y0, int& x1, int& y1) const;
+    // Table value `entry` (0 to 2 * channels - 1) of the clamped window.
+    [[nodiscard]] S windowEntry(std::size_t entry, int x0, int y0, int x1, int y1) const noexcept;
+};
+
+using PixelSumChannelsU8 = PixelSumChannels<std::uint8_t, std::uint32_t>;
+using PixelSumChannelsU16 = PixelSumChannels<std::uint16_t, std::uint64_t>;
+using PixelSumChannelsU8Wide = PixelSumChannels<std::uint8_t, std::uint64_t>;
+
+// The current PixelSum of a live image source, shared by many reader threads while a writer publishes new frames.
+// Readers pin the current snapshot without locking: each announces the snapshot it reads in a slot of its own (a
+// hazard pointer) and re-checks that it is still current. The writer builds the next frame off to the side into a
+// retired snapshot that no slot points at, through rebuild() so same-sized frames allocate nothing, and swaps it in
+// atomically. Snapshots still pinned are left alone until their readers let go.
+template <typename T, typename S>
+class PixelSumSnapshots {
+    struct Node;
+    struct Slot;
+
+public:
+    // Keeps one snapshot alive and unchanged until destroyed.
+    class Snapshot {
+    public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot& operator=(Snapshot&&) = delete;
+        ~Snapshot();
+
+        [[nodiscard]] const PixelSum<T, S>& operator*() const noexcept;
+        [[nodiscard]] const PixelSum<T, S>* operator->() const noexcept;
+        // Number of publish() calls before this frame; 0 for the frame given to the constructor.
+        [[nodiscard]] std::uint64_t version() const noexcept;
+
+    private:
+        friend class PixelSumSnapshots;
+        Snapshot(Slot* slot, const Node* node) noexcept;
+
+        Slot* slot_{nullptr};
+        const Node* node_{nullptr};
+    };
+
+    // The slot of one reader thread; it can hold one Snapshot at a time.
+    class Reader {
+    public:
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        Reader(Reader&& other) noexcept;
+        Reader& operator=(Reader&&) = delete;
+        ~Reader();
+
+        // Pins the current snapshot; throws if this reader still holds one.
+        [[nodiscard]] Snapshot acquire();
+
+    private:
+        friend class PixelSumSnapshots;
+        Reader(const PixelSumSnapshots* owner, Slot* slot) noexcept;
+
+        const PixelSumSnapshots* owner_{nullptr};
+        Slot* slot_{nullptr};
+    };
+
+    // Builds the first snapshot. PixelSumOptions::lazy is rejected: a snapshot must not read its frame after
+    // publication.
+    explicit PixelSumSnapshots(const PixelSumImage<T>& image, const PixelSumOptions& options = {});
+    explicit PixelSumSnapshots(std::span<const T> buffer, int width, int height, const PixelSumOptions& options = {});
+    PixelSumSnapshots(const PixelSumSnapshots&) = delete;
+    PixelSumSnapshots& operator=(const PixelSumSnapshots&) = delete;
+    // Every Reader and Snapshot must be gone by then.
+    ~PixelSumSnapshots();
+
+    // A reader for the calling thread; slots of destroyed readers are reused.
+    [[nodiscard]] Reader reader();
+
+    // Builds the tables of the frame into a recycled snapshot and makes it current. Calls are serialized; readers
+    // see the new frame from their next acquire(). On error the current snapshot is left as it was.
+    void publish(const PixelSumImage<T>& image);
+    void publish(std::span<const T> buffer, int width, int height);
+
+    // Version of the current snapshot.
+    [[nodiscard]] std::uint64_t version() const noexcept;
+    // Snapshots in memory: the current one plus the retired ones kept pinned or as spares for recycling.
+    [[nodiscard]] std::size_t snapshotCount() const;
+
+private:
+    struct Node {
+        PixelSum<T, S> pixel_sum;
+        std::uint64_t version{0};
+    };
+    // A cache line per slot, so readers do not share one.
+    struct alignas(64) Slot {
+        std::atomic<const Node*> pinned{nullptr};
+        std::atomic<bool> claimed{false};
+    };
+
+    PixelSumOptions options_{};
+    std::atomic<Node*> current_{nullptr};
+    // Kept apart from the nodes, which the writer may recycle under an unpinned reader of version().
+    std::atomic<std::uint64_t> version_{0};
+    // Writer state: the current snapshot's owner, and the retired snapshots.
+    mutable std::mutex writer_mutex_{};
+    std::unique_ptr<Node> current_owner_{};
+    std::vector<std::unique_ptr<Node>> retired_{};
+    // A deque never moves its elements, so readers keep their slot addresses while others register.
+    mutable std::mutex slots_mutex_{};
+    std::deque<Slot> slots_{};
+
+    [[nodiscard]] bool isPinned(const Node* node) const;
+    // publish() for either frame form: rebuild(frame...) or PixelSum(frame..., options_).
+    template <typename... Frame>
+    void publishFrame(const Frame&... frame);
+};
+
+using PixelSumSnapshotsU8 = PixelSumSnapshots<std::uint8_t, std::uint32_t>;
+using PixelSumSnapshotsU16 = PixelSumSnapshots<std::uint16_t, std::uint64_t>;
+using PixelSumSnapshotsU8Wide = PixelSumSnapshots<std::uint8_t, std::uint64_t>;
+
+template <typename T, typename S>
+class PixelSumBatch;
+
+// Read-only view of one patch of a PixelSumBatch, with the PixelSum getters (clamped the same way) and their
+// unchecked variants. Its tables carry a zero top row and left column, so a window is four loads. Valid until the
+// batch is rebuilt or destroyed.
+template <typename T, typename S>
+class PixelSumPatch {
+public:
+    [[nodiscard]] int width() const noexcept { return width_; }
+    [[nodiscard]] int height() const noexcept { return height_; }
+
+    [[nodiscard]] S getPixelSum(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] double getPixelAverage(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] S getNonZeroCount(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] double getNonZeroAverage(int x0, int y0, int x1, int y1) const noexcept;
+
+    [[nodiscard]] S getPixelSumUnchecked(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] double getPixelAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] S getNonZeroCountUnchecked(int x0, int y0, int x1, int y1) const noexcept;
+    [[nodiscard]] double getNonZeroAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept;
+
+private:
+    friend class PixelSumBatch<T, S>;
+    PixelSumPatch(const S* summed, const S* nonzero, int width, int height) noexcept;
+
+    const S* summed_{nullptr};
+    const S* nonzero_{nullptr};
+    int width_{0};
+    int height_{0};
+
+    [[nodiscard]] bool clampBounds(int& x0, int& y0, int& x1, int& y1) const noexcept;
+    [[nodiscard]] S windowOf(const S* table, int x0, int y0, int x1, int y1) const noexcept;
+};
+
+// Integral images of many small images (detected patches, tiles, ...) built together. The tables of every patch
+// share one arena, sized up front, so a batch costs a few allocations instead of several per patch, and rebuild()
+// reuses the arena. Patches are spread over threads that steal ranges of patches from each other, so uneven patch
+// sizes still keep every thread busy.
+template <typename T, typename S>
+class PixelSumBatch {
+public:
+    // thread_count works as in PixelSumOptions: 0 uses every hardware thread.
+    explicit PixelSumBatch(std::span<const PixelSumImage<T>> images, unsigned int thread_count = 1);
+    // A copy starts its own threads on its first parallel rebuild.
+    PixelSumBatch(const PixelSumBatch& other);
+    PixelSumBatch& operator=(const PixelSumBatch& other);
+    PixelSumBatch(PixelSumBatch&& other) noexcept;
+    PixelSumBatch& operator=(PixelSumBatch&& other) noexcept;
+    ~PixelSumBatch();
+
+    // Rebuilds every table from a new set of images in the same arena. The worker threads started by the first
+    // parallel build are kept and handed the new patches, so nothing is allocated unless the arena has to grow.
+    void rebuild(std::span<const PixelSumImage<T>> images);
+
+    [[nodiscard]] std::size_t size() const noexcept { return patches_.size(); }
+    [[nodiscard]] PixelSumPatch<T, S> operator[](std::size_t index) const noexcept;
+    // operator[] that throws for an index out of bound.
+    [[nodiscard]] PixelSumPatch<T, S> at(std::size_t index) const;
+
+private:
+    struct PatchEntry {
+        std::size_t offset;
+        int width;
+        int height;
+    };
+
+    class Workers;
+
+    unsigned int thread_count_{1};
+    std::vector<PatchEntry> patches_{};
+    // [summed | nonzero] of every patch, each (width + 1) * (height + 1) entries.
+    std::vector<S> arena_{};
+    // thread_count_ - 1 parked threads, started by the first rebuild with more than one patch and thread.
+    std::unique_ptr<Workers> workers_{};
+};
+
+using PixelSumBatchU8 = PixelSumBatch<std::uint8_t, std::uint32_t>;
+using PixelSumBatchU16 = PixelSumBatch<std::uint16_t, std::uint64_t>;
+using PixelSumBatchU8Wide = PixelSumBatch<std::uint8_t, std::uint64_t>;
+
+// PixelSum for images whose dimensions are fixed at compile time, such as 32x32 or 64x64 patches. Both tables live
+// inline in std::array, so nothing is allocated, and they carry a zero top row and left column, so a window is
+// four loads at constexpr-computed offsets. The getters clamp exactly like PixelSum's.
+template <typename T, typename S, int W, int H>
+class PixelSumFixed {
+public:
+    static_assert(W > 0 && H > 0, "PixelSumFixed needs a non-empty image");
+    static_assert(static_cast<std::uint64_t>(W) * static_cast<std::uint64_t>(H) <=
+                      static_cast<std::uint64_t>(std::numeric_limits<S>::max()) / std::numeric_limits<T>::max(),
+                  "Window sums of a W x H image must fit in S");
+
+    // Reads W * H row-major pixels.
+    constexpr explicit PixelSumFixed(const T* buffer) noexcept
+    {
+        for (int y = 0; y < H; ++y) {
+            S row_sum{};
+            S row_nonzero{};
+            for (int x = 0; x < W; ++x) {
+                const T pixel = buffer[static_cast<std::size_t>(y) * W + static_cast<std::size_t>(x)];
+                row_sum += static_cast<S>(pixel);
+                row_nonzero += pixel != T{} ? S{ 1 } : S{};
+                summed_[indexOf(x + 1, y + 1)] = summed_[indexOf(x + 1, y)] + row_sum;
+                nonzero_[indexOf(x + 1, y + 1)] = nonzero_[indexOf(x + 1, y)] + row_nonzero;
+            }
+        }
+    }
+
+    constexpr explicit PixelSumFixed(std::span<const T> buffer)
+        : PixelSumFixed(checkedData(buffer))
+    {
+    }
+
+    [[nodiscard]] static constexpr int width() noexcept { return W; }
+    [[nodiscard]] static constexpr int height() noexcept { return H; }
+
+    [[nodiscard]] constexpr S getPixelSum(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return clampBounds(x0, y0, x1, y1) ? getPixelSumUnchecked(x0, y0, x1, y1) : S{};
+    }
+
+    [[nodiscard]] constexpr double getPixelAverage(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return clampBounds(x0, y0, x1, y1) ? getPixelAverageUnchecked(x0, y0, x1, y1) : 0.0;
+    }
+
+    [[nodiscard]] constexpr S getNonZeroCount(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return clampBounds(x0, y0, x1, y1) ? getNonZeroCountUnchecked(x0, y0, x1, y1) : S{};
+    }
+
+    [[nodiscard]] constexpr double getNonZeroAverage(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return clampBounds(x0, y0, x1, y1) ? getNonZeroAverageUnchecked(x0, y0, x1, y1) : 0.0;
+    }
+
+    // As PixelSum's unchecked getters: 0 <= x0 <= x1 < W and 0 <= y0 <= y1 < H must hold.
+    [[nodiscard]] constexpr S getPixelSumUnchecked(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return summedArea(summed_, x0, y0, x1, y1);
+    }
+
+    [[nodiscard]] constexpr double getPixelAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept
+    {
+        const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+        return static_cast<double>(summedArea(summed_, x0, y0, x1, y1)) / count;
+    }
+
+    [[nodiscard]] constexpr S getNonZeroCountUnchecked(int x0, int y0, int x1, int y1) const noexcept
+    {
+        return summedArea(nonzero_, x0, y0, x1, y1);
+    }
+
+    [[nodiscard]] constexpr double getNonZeroAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept
+    {
+        const S count = summedArea(nonzero_, x0, y0, x1, y1);
+        return count > S{} ? static_cast<double>(summedArea(summed_, x0, y0, x1, y1)) / static_cast<double>(count) : 0.0;
+    }
+
+private:
+    static constexpr std::size_t kStride = static_cast<std::size_t>(W) + 1;
+    using Table = std::array<S, kStride * (static_cast<std::size_t>(H) + 1)>;
+
+    Table summed_{};
+    Table nonzero_{};
+
+    static constexpr const T* checkedData(std::span<const T> buffer)
+    {
+        if (buffer.size() < static_cast<std::size_t>(W) * static_cast<std::size_t>(H)) {
+            throw std::runtime_error("Buffer size is smaller than width*height");
+        }
+        return buffer.data();
+    }
+
+    // Offset of padded coordinates, i.e. image pixel (x - 1, y - 1).
+    static constexpr std::size_t indexOf(int x, int y) noexcept
+    {
+        return static_cast<std::size_t>(y) * kStride + static_cast<std::size_t>(x);
+    }
+
+    static constexpr S summedArea(const Table& table, int x0, int y0, int x1, int y1) noexcept
+    {
+        return table[indexOf(x1 + 1, y1 + 1)] - table[indexOf(x0, y1 + 1)] - table[indexOf(x1 + 1, y0)] + table[indexOf(x0, y0)];
+    }
+
+    static constexpr bool clampBounds(int& x0, int& y0, int& x1, int& y1) noexcept
+    {
+        if (x0 > x1) {
+            std::swap(x0, x1);
+        }
+        if (y0 > y1) {
+            std::swap(y0, y1);
+        }
+        if (x1 < 0 || x0 >= W || y1 < 0 || y0 >= H) {
+            return false;
+        }
+
+        x0 = std::clamp(x0, 0, W - 1);
+        y0 = std::clamp(y0, 0, H - 1);
+        x1 = std::clamp(x1, 0, W - 1);
+        y1 = std::clamp(y1, 0, H - 1);
+        return true;
+    }
+};
+
+template <int W, int H>
+using PixelSumFixedU8 = PixelSumFixed<std::uint8_t, std::uint32_t, W, H>;
+template <int W, int H>
+using PixelSumFixedU16 = PixelSumFixed<std::uint16_t, std::uint64_t, W, H>;
@@ -1,139 +1,3728 @@
 #include "pixel_sum/pixel_sum.hpp"
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <ostream>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if PIXEL_SUM_ENABLE_STATS
+#include <atomic>
+#include <mutex>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PIXEL_SUM_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace {
-template <typename T, typename S, typename Transformer>
-void buildIntegralImage(std::span<const T> source,
-                        int width,
-                        int height,
-                        std::span<S> target,
-                        Transformer transformer)
-{
-    const auto at = [width](int x, int y) -> std::size_t {
-        return static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x);
+// Both integral images are built together, one source row at a time, with the recurrence
+//   I(x, y) = I(x, y - 1) + (p(0, y) + ... + p(x, y))
+// i.e. a running prefix sum of the source row added to the previous output row. Unsigned wrap-around makes it
+// bit-identical to the classic four-term recurrence, and unlike that one the row prefix sum vectorizes.
+template <bool kHasPrevious, typename T, typename S>
+void accumulateRowTail(const T* source,
+                       int begin,
+                       int width,
+                       const S* previous_sum,
+                       const S* previous_nonzero,
+                       S* sum,
+                       S* nonzero,
+                       S running_sum,
+                       S running_nonzero)
+{
+    for (int x = begin; x < width; ++x) {
+        running_sum += static_cast<S>(source[x]);
+        running_nonzero += source[x] > T{} ? S{1} : S{0};
+        if constexpr (kHasPrevious) {
+            sum[x] = previous_sum[x] + running_sum;
+            nonzero[x] = previous_nonzero[x] + running_nonzero;
+        } else {
+            sum[x] = running_sum;
+            nonzero[x] = running_nonzero;
+        }
+    }
+}
+
+template <bool kHasPrevious, typename T, typename S>
+struct RowAccumulator {
+    static void run(const T* source, int width, const S* previous_sum, const S* previous_nonzero, S* sum, S* nonzero)
+    {
+        accumulateRowTail<kHasPrevious>(source, 0, width, previous_sum, previous_nonzero, sum, nonzero, S{}, S{});
+    }
+};
+
+#if defined(__AVX2__)
+// Inclusive prefix sum of the eight 32-bit lanes, offset by the broadcast carry.
+inline __m256i prefixSumU32(__m256i value, __m256i carry)
+{
+    value = _mm256_add_epi32(value, _mm256_slli_si256(value, 4));
+    value = _mm256_add_epi32(value, _mm256_slli_si256(value, 8));
+    const __m256i low_total = _mm256_shuffle_epi32(value, 0xFF);
+    value = _mm256_add_epi32(value, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+    return _mm256_add_epi32(value, carry);
+}
+
+// Inclusive prefix sum of the four 64-bit lanes, offset by the broadcast carry.
+inline __m256i prefixSumU64(__m256i value, __m256i carry)
+{
+    value = _mm256_add_epi64(value, _mm256_slli_si256(value, 8));
+    const __m256i low_total = _mm256_shuffle_epi32(value, 0xEE);
+    value = _mm256_add_epi64(value, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+    return _mm256_add_epi64(value, carry);
+}
+
+template <bool kHasPrevious>
+inline void storeRowU32(__m256i value, const std::uint32_t* previous, std::uint32_t* target, int x)
+{
+    if constexpr (kHasPrevious) {
+        value = _mm256_add_epi32(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(previous + x)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), value);
+}
+
+template <bool kHasPrevious>
+inline void storeRowU64(__m256i value, const std::uint64_t* previous, std::uint64_t* target, int x)
+{
+    if constexpr (kHasPrevious) {
+        value = _mm256_add_epi64(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(previous + x)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), value);
+}
+
+template <bool kHasPrevious>
+struct RowAccumulator<kHasPrevious, std::uint8_t, std::uint32_t> {
+    static void run(const std::uint8_t* source,
+                    int width,
+                    const std::uint32_t* previous_sum,
+                    const std::uint32_t* previous_nonzero,
+                    std::uint32_t* sum,
+                    std::uint32_t* nonzero)
+    {
+        const __m256i last_lane = _mm256_set1_epi32(7);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        __m256i carry_sum = _mm256_setzero_si256();
+        __m256i carry_nonzero = _mm256_setzero_si256();
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            const __m128i pixels = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + x));
+            const __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi8(pixels, zero), one);
+
+            const __m256i row_sum = prefixSumU32(_mm256_cvtepu8_epi32(pixels), carry_sum);
+            const __m256i row_nonzero = prefixSumU32(_mm256_cvtepu8_epi32(mask), carry_nonzero);
+            carry_sum = _mm256_permutevar8x32_epi32(row_sum, last_lane);
+            carry_nonzero = _mm256_permutevar8x32_epi32(row_nonzero, last_lane);
+
+            storeRowU32<kHasPrevious>(row_sum, previous_sum, sum, x);
+            storeRowU32<kHasPrevious>(row_nonzero, previous_nonzero, nonzero, x);
+        }
+
+        accumulateRowTail<kHasPrevious>(source,
+                                        x,
+                                        width,
+                                        previous_sum,
+                                        previous_nonzero,
+                                        sum,
+                                        nonzero,
+                                        static_cast<std::uint32_t>(_mm256_cvtsi256_si32(carry_sum)),
+                                        static_cast<std::uint32_t>(_mm256_cvtsi256_si32(carry_nonzero)));
+    }
+};
+
+// Loads four pixels as the low four 16-bit lanes.
+inline __m128i loadWords4(const std::uint16_t* source)
+{
+    return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source));
+}
+
+inline __m128i loadWords4(const std::uint8_t* source)
+{
+    std::int32_t bytes = 0;
+    std::memcpy(&bytes, source, sizeof(bytes));
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+}
+
+template <bool kHasPrevious, typename T>
+    requires std::is_same_v<T, std::uint8_t> || std::is_same_v<T, std::uint16_t>
+struct RowAccumulator<kHasPrevious, T, std::uint64_t> {
+    static void run(const T* source,
+                    int width,
+                    const std::uint64_t* previous_sum,
+                    const std::uint64_t* previous_nonzero,
+                    std::uint64_t* sum,
+                    std::uint64_t* nonzero)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        __m256i carry_sum = _mm256_setzero_si256();
+        __m256i carry_nonzero = _mm256_setzero_si256();
+
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            const __m128i pixels = loadWords4(source + x);
+            const __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi16(pixels, zero), one);
+
+            const __m256i row_sum = prefixSumU64(_mm256_cvtepu16_epi64(pixels), carry_sum);
+            const __m256i row_nonzero = prefixSumU64(_mm256_cvtepu16_epi64(mask), carry_nonzero);
+            carry_sum = _mm256_permute4x64_epi64(row_sum, 0xFF);
+            carry_nonzero = _mm256_permute4x64_epi64(row_nonzero, 0xFF);
+
+            storeRowU64<kHasPrevious>(row_sum, previous_sum, sum, x);
+            storeRowU64<kHasPrevious>(row_nonzero, previous_nonzero, nonzero, x);
+        }
+
+        std::uint64_t running_sum = 0;
+        std::uint64_t running_nonzero = 0;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&running_sum), _mm256_castsi256_si128(carry_sum));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&running_nonzero), _mm256_castsi256_si128(carry_nonzero));
+        accumulateRowTail<kHasPrevious>(
+            source, x, width, previous_sum, previous_nonzero, sum, nonzero, running_sum, running_nonzero);
+    }
+};
+#elif defined(__SSE2__)
+// Inclusive prefix sum of the four 32-bit lanes, offset by the broadcast carry.
+inline __m128i prefixSumU32(__m128i value, __m128i carry)
+{
+    value = _mm_add_epi32(value, _mm_slli_si128(value, 4));
+    value = _mm_add_epi32(value, _mm_slli_si128(value, 8));
+    return _mm_add_epi32(value, carry);
+}
+
+// Inclusive prefix sum of the two 64-bit lanes, offset by the broadcast carry.
+inline __m128i prefixSumU64(__m128i value, __m128i carry)
+{
+    value = _mm_add_epi64(value, _mm_slli_si128(value, 8));
+    return _mm_add_epi64(value, carry);
+}
+
+template <bool kHasPrevious>
+inline void storeRowU32(__m128i value, const std::uint32_t* previous, std::uint32_t* target, int x)
+{
+    if constexpr (kHasPrevious) {
+        value = _mm_add_epi32(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + x)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), value);
+}
+
+template <bool kHasPrevious>
+inline void storeRowU64(__m128i value, const std::uint64_t* previous, std::uint64_t* target, int x)
+{
+    if constexpr (kHasPrevious) {
+        value = _mm_add_epi64(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + x)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), value);
+}
+
+template <bool kHasPrevious>
+struct RowAccumulator<kHasPrevious, std::uint8_t, std::uint32_t> {
+    static void run(const std::uint8_t* source,
+                    int width,
+                    const std::uint32_t* previous_sum,
+                    const std::uint32_t* previous_nonzero,
+                    std::uint32_t* sum,
+                    std::uint32_t* nonzero)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i carry_sum = zero;
+        __m128i carry_nonzero = zero;
+
+        const auto accumulate =
+            [&](__m128i words, __m128i& carry, const std::uint32_t* previous, std::uint32_t* target, int offset) {
+            const __m128i low = prefixSumU32(_mm_unpacklo_epi16(words, zero), carry);
+            const __m128i high = prefixSumU32(_mm_unpackhi_epi16(words, zero), _mm_shuffle_epi32(low, 0xFF));
+            carry = _mm_shuffle_epi32(high, 0xFF);
+            storeRowU32<kHasPrevious>(low, previous, target, offset);
+            storeRowU32<kHasPrevious>(high, previous, target, offset + 4);
+        };
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+            const __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi8(pixels, zero), one);
+
+            accumulate(_mm_unpacklo_epi8(pixels, zero), carry_sum, previous_sum, sum, x);
+            accumulate(_mm_unpackhi_epi8(pixels, zero), carry_sum, previous_sum, sum, x + 8);
+            accumulate(_mm_unpacklo_epi8(mask, zero), carry_nonzero, previous_nonzero, nonzero, x);
+            accumulate(_mm_unpackhi_epi8(mask, zero), carry_nonzero, previous_nonzero, nonzero, x + 8);
+        }
+
+        accumulateRowTail<kHasPrevious>(source,
+                                        x,
+                                        width,
+                                        previous_sum,
+                                        previous_nonzero,
+                                        sum,
+                                        nonzero,
+                                        static_cast<std::uint32_t>(_mm_cvtsi128_si32(carry_sum)),
+                                        static_cast<std::uint32_t>(_mm_cvtsi128_si32(carry_nonzero)));
+    }
+};
+
+// Loads eight pixels as 16-bit lanes.
+inline __m128i loadWords8(const std::uint16_t* source)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+}
+
+inline __m128i loadWords8(const std::uint8_t* source)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)), _mm_setzero_si128());
+}
+
+template <bool kHasPrevious, typename T>
+    requires std::is_same_v<T, std::uint8_t> || std::is_same_v<T, std::uint16_t>
+struct RowAccumulator<kHasPrevious, T, std::uint64_t> {
+    static void run(const T* source,
+                    int width,
+                    const std::uint64_t* previous_sum,
+                    const std::uint64_t* previous_nonzero,
+                    std::uint64_t* sum,
+                    std::uint64_t* nonzero)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        __m128i carry_sum = zero;
+        __m128i carry_nonzero = zero;
+
+        const auto accumulate =
+            [&](__m128i dwords, __m128i& carry, const std::uint64_t* previous, std::uint64_t* target, int offset) {
+            const __m128i low = prefixSumU64(_mm_unpacklo_epi32(dwords, zero), carry);
+            const __m128i high = prefixSumU64(_mm_unpackhi_epi32(dwords, zero), _mm_shuffle_epi32(low, 0xEE));
+            carry = _mm_shuffle_epi32(high, 0xEE);
+            storeRowU64<kHasPrevious>(low, previous, target, offset);
+            storeRowU64<kHasPrevious>(high, previous, target, offset + 2);
+        };
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            const __m128i pixels = loadWords8(source + x);
+            const __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi16(pixels, zero), one);
+
+            accumulate(_mm_unpacklo_epi16(pixels, zero), carry_sum, previous_sum, sum, x);
+            accumulate(_mm_unpackhi_epi16(pixels, zero), carry_sum, previous_sum, sum, x + 4);
+            accumulate(_mm_unpacklo_epi16(mask, zero), carry_nonzero, previous_nonzero, nonzero, x);
+            accumulate(_mm_unpackhi_epi16(mask, zero), carry_nonzero, previous_nonzero, nonzero, x + 4);
+        }
+
+        std::uint64_t running_sum = 0;
+        std::uint64_t running_nonzero = 0;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&running_sum), carry_sum);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&running_nonzero), carry_nonzero);
+        accumulateRowTail<kHasPrevious>(
+            source, x, width, previous_sum, previous_nonzero, sum, nonzero, running_sum, running_nonzero);
+    }
+};
+#endif
+
+// Accumulates one source row into both tables; a null previous row means the first row of the image.
+template <typename T, typename S>
+void accumulateRow(const T* source, int width, const S* previous_sum, const S* previous_nonzero, S* sum, S* nonzero)
+{
+    if (previous_sum == nullptr) {
+        RowAccumulator<false, T, S>::run(source, width, previous_sum, previous_nonzero, sum, nonzero);
+    } else {
+        RowAccumulator<true, T, S>::run(source, width, previous_sum, previous_nonzero, sum, nonzero);
+    }
+}
+
+// out = d - b - c + a, lane by lane.
+template <typename S>
+void combineCorners(const S* d, const S* b, const S* c, const S* a, S* out, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = d[i] - b[i] - c[i] + a[i];
+    }
+}
+
+#if defined(__SSE2__)
+template <>
+void combineCorners<std::uint32_t>(const std::uint32_t* d,
+                                   const std::uint32_t* b,
+                                   const std::uint32_t* c,
+                                   const std::uint32_t* a,
+                                   std::uint32_t* out,
+                                   std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i value = _mm_add_epi32(
+            _mm_sub_epi32(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+    }
+    for (; i < count; ++i) {
+        out[i] = d[i] - b[i] - c[i] + a[i];
+    }
+}
+
+template <>
+void combineCorners<std::uint64_t>(const std::uint64_t* d,
+                                   const std::uint64_t* b,
+                                   const std::uint64_t* c,
+                                   const std::uint64_t* a,
+                                   std::uint64_t* out,
+                                   std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128i value = _mm_add_epi64(
+            _mm_sub_epi64(_mm_sub_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+    }
+    for (; i < count; ++i) {
+        out[i] = d[i] - b[i] - c[i] + a[i];
+    }
+}
+#endif
+
+// Memory layout of PixelSumLayout::Tiled: the image is cut into page-sized tiles of kTileWidth columns by
+// kTileHeight rows, stored one after another in row-major tile order, and inside a tile every pixel holds its
+// [sum, nonzero] pair next to each other.
+template <typename S>
+struct TileGeometry {
+    static constexpr int kTileWidth = 16;
+    static constexpr int kTileHeight = 4096 / static_cast<int>(kTileWidth * 2 * sizeof(S));
+    static constexpr std::size_t kTileEntries = static_cast<std::size_t>(kTileWidth) * kTileHeight * 2;
+    static_assert((kTileHeight & (kTileHeight - 1)) == 0, "Tile height must be a power of two");
+
+    int tiles_per_row{0};
+
+    explicit TileGeometry(int width)
+        : tiles_per_row((width + kTileWidth - 1) / kTileWidth)
+    {
+    }
+
+    [[nodiscard]] std::size_t size(int height) const noexcept
+    {
+        const auto tile_rows = static_cast<std::size_t>((height + kTileHeight - 1) / kTileHeight);
+        return tile_rows * static_cast<std::size_t>(tiles_per_row) * kTileEntries;
+    }
+
+    // Offset of the [sum, nonzero] pair of pixel (x, y); the tile sides are powers of two so this is shifts and masks.
+    [[nodiscard]] std::size_t offsetOf(int x, int y) const noexcept
+    {
+        constexpr auto kWidth = static_cast<std::size_t>(kTileWidth);
+        constexpr auto kHeight = static_cast<std::size_t>(kTileHeight);
+        const auto column = static_cast<std::size_t>(x);
+        const auto row = static_cast<std::size_t>(y);
+
+        const auto tile = (row / kHeight) * static_cast<std::size_t>(tiles_per_row) + column / kWidth;
+        return tile * kTileEntries + ((row % kHeight) * kWidth + column % kWidth) * 2;
+    }
+};
+
+// Row sinks hand out the rows the builder writes into and store them once complete, given the integral image row
+// above (null for the first image row). The previous row handed out must stay readable until the next one is
+// committed, since it seeds the recurrence. Strips handed to one sink start at a multiple of kRowAlignment. Sinks
+// that stage rows elsewhere borrow scratchSize(width) entries from the caller instead of allocating them.
+// An empty `summed` or `nonzero` table of RowMajorSink is not stored: its rows alternate between two scratch rows,
+// which keeps the previous row readable as the recurrence needs.
+template <typename S>
+class RowMajorSink {
+public:
+    RowMajorSink(std::span<S> summed, std::span<S> nonzero, std::span<S> scratch, int width)
+        : summed_(summed)
+        , nonzero_(nonzero)
+        , scratch_(scratch)
+        , width_(static_cast<std::size_t>(width))
+    {
+    }
+
+    // Only borrowed when a table is skipped.
+    [[nodiscard]] static std::size_t scratchSize(int width) noexcept { return 4 * static_cast<std::size_t>(width); }
+
+    [[nodiscard]] std::pair<S*, S*> row(int y) const noexcept
+    {
+        const auto offset = static_cast<std::size_t>(y) * width_;
+        const auto slot = static_cast<std::size_t>(y & 1) * width_;
+        return { summed_.empty() ? scratch_.data() + slot : summed_.data() + offset,
+                 nonzero_.empty() ? scratch_.data() + 2 * width_ + slot : nonzero_.data() + offset };
+    }
+
+    void commit(int /*y*/, const S* /*previous_sum*/, const S* /*previous_nonzero*/) const noexcept {}
+
+    static constexpr int kRowAlignment = 1;
+
+private:
+    std::span<S> summed_;
+    std::span<S> nonzero_;
+    std::span<S> scratch_;
+    std::size_t width_;
+};
+
+template <typename S>
+class TiledSink {
+public:
+    TiledSink(std::span<S> tiled, std::span<S> scratch, int width)
+        : tiled_(tiled)
+        , geometry_(width)
+        , width_(width)
+        , scratch_(scratch)
+    {
+    }
+
+    [[nodiscard]] static std::size_t scratchSize(int width) noexcept { return 4 * static_cast<std::size_t>(width); }
+
+    [[nodiscard]] std::pair<S*, S*> row(int y) noexcept
+    {
+        S* base = scratch_.data() + static_cast<std::size_t>(y & 1) * 2 * static_cast<std::size_t>(width_);
+        return { base, base + width_ };
+    }
+
+    void commit(int y, const S* /*previous_sum*/, const S* /*previous_nonzero*/) noexcept
+    {
+        const auto [sum, nonzero] = row(y);
+        for (int x0 = 0; x0 < width_; x0 += TileGeometry<S>::kTileWidth) {
+            S* target = tiled_.data() + geometry_.offsetOf(x0, y);
+            const int x1 = std::min(x0 + TileGeometry<S>::kTileWidth, width_);
+            for (int x = x0; x < x1; ++x) {
+                *target++ = sum[x];
+                *target++ = nonzero[x];
+            }
+        }
+    }
+
+    static constexpr int kRowAlignment = 1;
+
+private:
+    std::span<S> tiled_;
+    TileGeometry<S> geometry_;
+    int width_;
+    // [row 0 sum | row 0 nonzero | row 1 sum | row 1 nonzero]
+    std::span<S> scratch_;
+};
+
+// Sum of the window from the integral image entries at(x, y), with the corners outside the image counting as 0.
+template <typename S, typename Reader>
+S summedArea(const Reader& at, int x0, int y0, int x1, int y1)
+{
+    const S d = at(x1, y1);
+    const S b = y0 > 0 ? at(x1, y0 - 1) : S{};
+    const S c = x0 > 0 ? at(x0 - 1, y1) : S{};
+    const S a = (x0 > 0 && y0 > 0) ? at(x0 - 1, y0 - 1) : S{};
+
+    return d - b - c + a;
+}
+
+// Side of the gridFilter() cells at `level` (the requested side, doubled per level) along an image side of `extent`
+// pixels; cells larger than the image cover all of it.
+int gridCellSide(int cell, int level, int extent) noexcept
+{
+    return static_cast<int>(std::min(static_cast<long long>(cell) << std::min(level, 31), static_cast<long long>(extent)));
+}
+
+// Memory layout of PixelSumLayout::Compact: the image is cut into kBlockSide x kBlockSide blocks. For a pixel (x, y)
+// in the block whose top-left pixel is (bx, by) every table entry is rebuilt as
+//   I(x, y) = left[y - by] + top[x - bx] + local(x, y)
+// with the full-width block bases left[] = I(bx - 1, y) and top[] = I(x, by - 1) - I(bx - 1, by - 1), and the narrow
+// local(x, y) = sum of the block's pixels from (bx, by) to (x, y) of type L. 16x16 blocks keep the sums of 8-bit
+// pixels in 16 bits; 32-bit locals (16-bit pixels) take 32x32 blocks, one 4 KiB page of locals each, which halves
+// the bases per pixel. The non-zero counts of either fit in 16 bits.
+template <typename L>
+struct BlockGeometry {
+    static constexpr int kBlockSide = sizeof(L) == 2 ? 16 : 32;
+    static constexpr std::size_t kBlockEntries = static_cast<std::size_t>(kBlockSide) * kBlockSide;
+    // [sum left | sum top | nonzero left | nonzero top]
+    static constexpr std::size_t kBaseEntries = 4 * static_cast<std::size_t>(kBlockSide);
+
+    int blocks_per_row{0};
+
+    explicit BlockGeometry(int width)
+        : blocks_per_row((width + kBlockSide - 1) / kBlockSide)
+    {
+    }
+
+    [[nodiscard]] std::size_t blocks(int height) const noexcept
+    {
+        return static_cast<std::size_t>((height + kBlockSide - 1) / kBlockSide) * static_cast<std::size_t>(blocks_per_row);
+    }
+
+    [[nodiscard]] std::size_t blockOf(int x, int y) const noexcept
+    {
+        constexpr auto kSide = static_cast<std::size_t>(kBlockSide);
+        return (static_cast<std::size_t>(y) / kSide) * static_cast<std::size_t>(blocks_per_row) +
+               static_cast<std::size_t>(x) / kSide;
+    }
+
+    [[nodiscard]] static std::size_t localOf(int x, int y) noexcept
+    {
+        constexpr auto kSide = static_cast<std::size_t>(kBlockSide);
+        return (static_cast<std::size_t>(y) % kSide) * kSide + static_cast<std::size_t>(x) % kSide;
+    }
+};
+
+template <typename S, typename L>
+class CompactSink {
+public:
+    CompactSink(
+        std::span<S> base, std::span<L> local_sum, std::span<std::uint16_t> local_nonzero, std::span<S> scratch, int width)
+        : base_(base)
+        , local_sum_(local_sum)
+        , local_nonzero_(local_nonzero)
+        , geometry_(width)
+        , width_(width)
+        , scratch_(scratch)
+    {
+    }
+
+    [[nodiscard]] static std::size_t scratchSize(int width) noexcept { return 6 * static_cast<std::size_t>(width); }
+
+    [[nodiscard]] std::pair<S*, S*> row(int y) noexcept
+    {
+        S* base = scratch_.data() + static_cast<std::size_t>(y & 1) * 2 * static_cast<std::size_t>(width_);
+        return { base, base + width_ };
+    }
+
+    void commit(int y, const S* previous_sum, const S* previous_nonzero) noexcept
+    {
+        constexpr int kSide = BlockGeometry<L>::kBlockSide;
+        S* top_sum = scratch_.data() + 4 * static_cast<std::size_t>(width_);
+        S* top_nonzero = top_sum + width_;
+
+        const bool band_start = y % kSide == 0;
+        if (band_start) {
+            // I(x, by - 1) of the new block row, kept until the band is complete.
+            for (int x = 0; x < width_; ++x) {
+                top_sum[x] = previous_sum != nullptr ? previous_sum[x] : S{};
+                top_nonzero[x] = previous_nonzero != nullptr ? previous_nonzero[x] : S{};
+            }
+        }
+
+        const auto [sum, nonzero] = row(y);
+        for (int bx = 0; bx < width_; bx += kSide) {
+            const std::size_t block = geometry_.blockOf(bx, y);
+            S* base = base_.data() + block * BlockGeometry<L>::kBaseEntries;
+            const int end = std::min(bx + kSide, width_);
+
+            const S left_sum = bx > 0 ? sum[bx - 1] : S{};
+            const S left_nonzero = bx > 0 ? nonzero[bx - 1] : S{};
+            const S corner_sum = bx > 0 ? top_sum[bx - 1] : S{};
+            const S corner_nonzero = bx > 0 ? top_nonzero[bx - 1] : S{};
+
+            base[y % kSide] = left_sum;
+            base[2 * kSide + y % kSide] = left_nonzero;
+            if (band_start) {
+                for (int x = bx; x < end; ++x) {
+                    base[kSide + x - bx] = top_sum[x] - corner_sum;
+                    base[3 * kSide + x - bx] = top_nonzero[x] - corner_nonzero;
+                }
+            }
+
+            const std::size_t local = block * BlockGeometry<L>::kBlockEntries + BlockGeometry<L>::localOf(bx, y);
+            for (int x = bx; x < end; ++x) {
+                local_sum_[local + static_cast<std::size_t>(x - bx)] =
+                    static_cast<L>(sum[x] - left_sum - top_sum[x] + corner_sum);
+                local_nonzero_[local + static_cast<std::size_t>(x - bx)] =
+                    static_cast<std::uint16_t>(nonzero[x] - left_nonzero - top_nonzero[x] + corner_nonzero);
+            }
+        }
+    }
+
+    static constexpr int kRowAlignment = BlockGeometry<L>::kBlockSide;
+
+private:
+    std::span<S> base_;
+    std::span<L> local_sum_;
+    std::span<std::uint16_t> local_nonzero_;
+    BlockGeometry<L> geometry_;
+    int width_;
+    // [row 0 sum | row 0 nonzero | row 1 sum | row 1 nonzero | top sum | top nonzero]
+    std::span<S> scratch_;
+};
+
+// Squared-pixel counterpart of accumulateRow(), into the always row-major 64-bit sum-of-squares table.
+template <typename T>
+void accumulateSquares(const T* source, int width, const std::uint64_t* previous, std::uint64_t* squares)
+{
+    std::uint64_t running = 0;
+    for (int x = 0; x < width; ++x) {
+        running += static_cast<std::uint64_t>(source[x]) * source[x];
+        squares[x] = (previous != nullptr ? previous[x] : 0) + running;
+    }
+}
+
+// Rotated (45 degree) tables: the cone C(x, y) is the sum of the pixels (i, j) with j <= y and |i - x| <= y - j, i.e.
+// everything inside the upward-opening right angle whose apex is (x, y). In the diagonal coordinates p = i + j and
+// q = j - i a cone is the quadrant p <= x + y, q <= y - x, so a rotated rectangle is four cones combined like the
+// corners of an upright window. Cones with the apex inside the image are stored; every other cone reduces to the
+// diagonal prefix sums P(p) = sum over i + j <= p and Q(q) = sum over j - i <= q:
+//   apex left of the image:  C = P(x + y)      (nothing in the quadrant lies right of the apex's other edge)
+//   apex right of the image: C = Q(y - x)
+//   apex below the last row: C = P(x + y) + Q(y - x) - total   (the opposite quadrant holds no rows)
+template <typename S>
+struct DiagonalSums {
+    // [P(0) ... P(width + height - 2) | Q(1 - width) ... Q(height - 1)]
+    const S* data;
+    int width;
+    int height;
+
+    [[nodiscard]] std::size_t size() const noexcept { return static_cast<std::size_t>(width) + height - 1; }
+
+    [[nodiscard]] S byP(long long p) const noexcept
+    {
+        return p < 0 ? S{} : data[static_cast<std::size_t>(std::min<long long>(p, width + height - 2))];
+    }
+
+    [[nodiscard]] S byQ(long long q) const noexcept
+    {
+        return q < 1 - width ? S{} : data[size() + static_cast<std::size_t>(std::min<long long>(q, height - 1) + width - 1)];
+    }
+
+    [[nodiscard]] S total() const noexcept { return data[size() - 1]; }
+};
+
+// Adds value(x, y) over the region to the diagonals of `diagonals` (2 * (width + height - 1) entries, laid out as
+// in DiagonalSums) and turns them into prefix sums.
+template <typename S, typename Value>
+void accumulateDiagonals(int width, int height, const PixelSumWindow& region, const Value& value, S* diagonals)
+{
+    const auto size = static_cast<std::size_t>(width) + height - 1;
+    S* by_p = diagonals;
+    S* by_q = diagonals + size;
+    for (int y = region.y0; y <= region.y1; ++y) {
+        for (int x = region.x0; x <= region.x1; ++x) {
+            const S v = value(x, y);
+            by_p[x + y] += v;
+            by_q[y - x + width - 1] += v;
+        }
+    }
+    for (std::size_t i = 1; i < size; ++i) {
+        by_p[i] += by_p[i - 1];
+        by_q[i] += by_q[i - 1];
+    }
+}
+
+// Cones of value(x, y) for rows [row_begin, row_end), assuming every value above row_begin is 0, with the
+// recurrence C(x, y) = C(x - 1, y - 1) + C(x + 1, y - 1) - C(x, y - 2) + v(x, y) + v(x, y - 1); the neighbours
+// outside the image come from the diagonal sums. emit(y, row) receives each finished row. `rows` holds the last three
+// rows (3 * width entries); every entry is written before it is read.
+template <typename S, typename Value, typename Emit>
+void accumulateCones(
+    const DiagonalSums<S>& diagonals, int row_begin, int row_end, std::span<S> rows, const Value& value, const Emit& emit)
+{
+    const int width = diagonals.width;
+    const auto row = static_cast<std::size_t>(width);
+
+    for (int y = row_begin; y < row_end; ++y) {
+        S* current = rows.data() + static_cast<std::size_t>(y % 3) * row;
+        const S* above = rows.data() + static_cast<std::size_t>((y + 2) % 3) * row;
+        const S* above_two = rows.data() + static_cast<std::size_t>((y + 1) % 3) * row;
+        const bool has_above = y - 1 >= row_begin;
+        const bool has_above_two = y - 2 >= row_begin;
+
+        for (int x = 0; x < width; ++x) {
+            const S left = x > 0 ? (has_above ? above[x - 1] : S{}) : (y > 0 ? diagonals.byP(y - 2) : S{});
+            const S right = x + 1 < width ? (has_above ? above[x + 1] : S{}) : (y > 0 ? diagonals.byQ(y - 1 - width) : S{});
+            const S middle = has_above_two ? above_two[x] : S{};
+            current[x] = left + right - middle + value(x, y) + (has_above ? value(x, y - 1) : S{});
+        }
+        emit(y, current);
+    }
+}
+
+// Builds rows [row_begin, row_end) through the sink, and the sum-of-squares table as well unless `squares` is empty;
+// the carry rows are the integral image rows just above row_begin, null for the first image row.
+template <typename T, typename S, typename Sink>
+void buildIntegralImages(const PixelSumImage<T>& source,
+                         int row_begin,
+                         int row_end,
+                         const S* carry_sum,
+                         const S* carry_nonzero,
+                         const std::uint64_t* carry_squares,
+                         Sink& sink,
+                         std::span<std::uint64_t> squares)
+{
+    const int width = source.width;
+    const auto row = static_cast<std::size_t>(width);
+
+    const S* previous_sum = carry_sum;
+    const S* previous_nonzero = carry_nonzero;
+    const std::uint64_t* previous_squares = carry_squares;
+    for (int y = row_begin; y < row_end; ++y) {
+        const T* pixels = source.row(y);
+        const auto [sum, nonzero] = sink.row(y);
+        accumulateRow<T, S>(pixels, width, previous_sum, previous_nonzero, sum, nonzero);
+        sink.commit(y, previous_sum, previous_nonzero);
+        previous_sum = sum;
+        previous_nonzero = nonzero;
+
+        if (!squares.empty()) {
+            std::uint64_t* target = squares.data() + static_cast<std::size_t>(y) * row;
+            accumulateSquares(pixels, width, previous_squares, target);
+            previous_squares = target;
+        }
+    }
+}
+
+template <typename Function>
+void parallelFor(unsigned int count, const Function& function)
+{
+    std::vector<std::jthread> workers;
+    workers.reserve(count > 0 ? count - 1 : 0);
+    for (unsigned int index = 1; index < count; ++index) {
+        workers.emplace_back(function, index);
+    }
+    if (count > 0) {
+        function(0U);
+    }
+}
+
+// `size` entries of this thread's scratch for const queries, which may run concurrently on one object. The buffer
+// only grows, so a query repeated on the same thread allocates nothing; its contents are left over from the last use.
+template <typename S>
+std::span<S> threadScratch(std::size_t size)
+{
+    thread_local std::vector<S> scratch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return std::span<S>(scratch).first(size);
+}
+
+// Indices 0 to count - 1 handed out to parallel workers. Every worker starts on its own slice and takes indices
+// from its front; a worker out of indices steals the back half of the slice with the most left. A slice is packed as
+// begin << 32 | end in one atomic, so a pop and a steal are each a single compare-exchange, and a slice only grows
+// again once its owner has emptied it, so a stale value never compares equal.
+class StealingRanges {
+public:
+    explicit StealingRanges(unsigned int workers, std::uint32_t count = 0)
+        : slices_(workers)
+    {
+        reset(workers, count);
+    }
+
+    // Spreads count new indices over the first `workers` slices and empties the others. No worker may be taking
+    // indices meanwhile.
+    void reset(unsigned int workers, std::uint32_t count) noexcept
+    {
+        for (std::size_t worker = 0; worker < slices_.size(); ++worker) {
+            const std::uint64_t begin = worker < workers ? std::uint64_t{ count } * worker / workers : 0;
+            const std::uint64_t end = worker < workers ? std::uint64_t{ count } * (worker + 1) / workers : 0;
+            slices_[worker].packed.store(pack(static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end)), std::memory_order_relaxed);
+        }
+    }
+
+    // Next index for `worker`; false once every slice is empty.
+    bool next(unsigned int worker, std::uint32_t& index)
+    {
+        while (!pop(slices_[worker].packed, index)) {
+            if (!steal(worker)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // A cache line per slice, so owners popping their own slices do not share one.
+    struct alignas(64) Slice {
+        std::atomic<std::uint64_t> packed{ 0 };
+    };
+    std::vector<Slice> slices_;
+
+    static std::uint64_t pack(std::uint32_t begin, std::uint32_t end) noexcept { return std::uint64_t{ begin } << 32U | end; }
+    static std::uint32_t beginOf(std::uint64_t packed) noexcept { return static_cast<std::uint32_t>(packed >> 32U); }
+    static std::uint32_t endOf(std::uint64_t packed) noexcept { return static_cast<std::uint32_t>(packed); }
+
+    static bool pop(std::atomic<std::uint64_t>& slice, std::uint32_t& index)
+    {
+        std::uint64_t packed = slice.load(std::memory_order_acquire);
+        while (beginOf(packed) < endOf(packed)) {
+            if (slice.compare_exchange_weak(packed, pack(beginOf(packed) + 1, endOf(packed)), std::memory_order_acq_rel)) {
+                index = beginOf(packed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(unsigned int thief)
+    {
+        for (;;) {
+            Slice* victim = nullptr;
+            std::uint64_t packed = 0;
+            for (auto& slice : slices_) {
+                const std::uint64_t candidate = slice.packed.load(std::memory_order_acquire);
+                if (&slice != &slices_[thief] && endOf(candidate) - beginOf(candidate) > endOf(packed) - beginOf(packed)) {
+                    victim = &slice;
+                    packed = candidate;
+                }
+            }
+            if (victim == nullptr) {
+                return false;
+            }
+
+            const std::uint32_t middle = beginOf(packed) + (endOf(packed) - beginOf(packed)) / 2;
+            if (victim->packed.compare_exchange_strong(packed, pack(beginOf(packed), middle), std::memory_order_acq_rel)) {
+                slices_[thief].packed.store(pack(middle, endOf(packed)), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+};
+
+// Number of strips buildIntegralImagesParallel() cuts an image of the given height into.
+unsigned int stripCount(int height, unsigned int thread_count) noexcept
+{
+    constexpr int kMinRowsPerStrip = 64;
+    return std::max(1U,
+                    std::min(thread_count, static_cast<unsigned int>((height + kMinRowsPerStrip - 1) / kMinRowsPerStrip)));
+}
+
+// Splits the image into horizontal strips. The first parallel pass reduces every strip to its column totals, a short
+// serial scan turns those into the integral image row just above each strip, and the second parallel pass builds each
+// strip seeded with that row. Every table entry is written exactly once, as in the serial build.
+// make_sink(strip) creates the row sink of one strip; with a single strip no threads or temporaries are allocated.
+// A non-empty `squares` gets the sum-of-squares table in the same passes.
+template <typename T, typename S, typename MakeSink>
+void buildIntegralImagesParallel(const PixelSumImage<T>& source,
+                                 unsigned int thread_count,
+                                 const MakeSink& make_sink,
+                                 std::span<std::uint64_t> squares)
+{
+    const int height = source.height;
+    const unsigned int strips = stripCount(height, thread_count);
+    if (strips == 1) {
+        auto sink = make_sink(0U);
+        buildIntegralImages<T, S>(source, 0, height, nullptr, nullptr, nullptr, sink, squares);
+        return;
+    }
+
+    const auto row = static_cast<std::size_t>(source.width);
+    using Sink = decltype(make_sink(0U));
+    const auto strip_begin = [height, strips](unsigned int strip) -> int {
+        if (strip == strips) {
+            return height;
+        }
+        const auto begin = static_cast<int>(static_cast<long long>(height) * strip / strips);
+        return begin - begin % Sink::kRowAlignment;
+    };
+
+    // [strip][sum row | nonzero row]: column totals of each strip, later reused for the carried integral image rows.
+    std::vector<S> totals(static_cast<std::size_t>(strips - 1) * 2 * row, S{});
+    const auto totals_of = [&totals, row](unsigned int strip) -> S* { return totals.data() + strip * 2 * row; };
+    std::vector<std::uint64_t> square_totals(squares.empty() ? 0 : static_cast<std::size_t>(strips - 1) * row, 0);
+    const auto square_totals_of = [&square_totals, row](unsigned int strip) -> std::uint64_t* {
+        return square_totals.empty() ? nullptr : square_totals.data() + strip * row;
     };
 
-    target[at(0, 0)] = transformer(source[at(0, 0)]);
+    parallelFor(strips - 1, [&](unsigned int strip) {
+        S* column_sum = totals_of(strip);
+        S* column_nonzero = column_sum + row;
+        std::uint64_t* column_squares = square_totals_of(strip);
+        for (auto y = static_cast<std::size_t>(strip_begin(strip)); y < static_cast<std::size_t>(strip_begin(strip + 1)); ++y) {
+            const T* pixels = source.row(static_cast<int>(y));
+            for (std::size_t x = 0; x < row; ++x) {
+                column_sum[x] += static_cast<S>(pixels[x]);
+                column_nonzero[x] += pixels[x] > T{} ? S{1} : S{0};
+            }
+            if (column_squares != nullptr) {
+                for (std::size_t x = 0; x < row; ++x) {
+                    column_squares[x] += static_cast<std::uint64_t>(pixels[x]) * pixels[x];
+                }
+            }
+        }
+    });
+
+    // Running column totals of all previous strips, row-prefixed in place into the carry row of the next strip.
+    std::vector<S> running(2 * row, S{});
+    for (unsigned int strip = 0; strip + 1 < strips; ++strip) {
+        S* column = totals_of(strip);
+        S sum{};
+        S count{};
+        for (std::size_t x = 0; x < row; ++x) {
+            running[x] += column[x];
+            running[row + x] += column[row + x];
+            sum += running[x];
+            count += running[row + x];
+            column[x] = sum;
+            column[row + x] = count;
+        }
+    }
+    if (!square_totals.empty()) {
+        std::vector<std::uint64_t> running_squares(row, 0);
+        for (unsigned int strip = 0; strip + 1 < strips; ++strip) {
+            std::uint64_t* column = square_totals_of(strip);
+            std::uint64_t squares_sum = 0;
+            for (std::size_t x = 0; x < row; ++x) {
+                running_squares[x] += column[x];
+                squares_sum += running_squares[x];
+                column[x] = squares_sum;
+            }
+        }
+    }
+
+    parallelFor(strips, [&](unsigned int strip) {
+        const S* carry = strip > 0 ? totals_of(strip - 1) : nullptr;
+        const std::uint64_t* carry_squares = strip > 0 ? square_totals_of(strip - 1) : nullptr;
+        auto sink = make_sink(strip);
+        buildIntegralImages<T, S>(source,
+                                  strip_begin(strip),
+                                  strip_begin(strip + 1),
+                                  carry,
+                                  carry != nullptr ? carry + row : nullptr,
+                                  carry_squares,
+                                  sink,
+                                  squares);
+    });
+}
+
+// Table file written by PixelSum::save(): this header, zero-padded to kTableFileHeaderSize bytes, then the row-major
+// sum table and the row-major non-zero table, those of `tables` that were saved, each width * height entries of S in
+// native byte order.
+struct TableFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    // kTableFileByteOrder as written by the saving machine.
+    std::uint32_t byte_order;
+    std::uint32_t pixel_bytes;
+    std::uint32_t sum_bytes;
+    std::int32_t width;
+    std::int32_t height;
+    // PixelSumTables bits of the tables in the file; version 1 files hold both and leave this 0.
+    std::uint32_t tables;
+};
+
+constexpr char kTableFileMagic[8] = { 'P', 'X', 'S', 'U', 'M', 'S', 'A', 'T' };
+constexpr std::uint32_t kTableFileVersion = 2;
+constexpr std::uint32_t kTableFileByteOrder = 0x01020304;
+// Keeps the tables aligned for any S.
+constexpr std::size_t kTableFileHeaderSize = 64;
+static_assert(sizeof(TableFileHeader) <= kTableFileHeaderSize);
+
+// Read-only view of a whole file: mmap()ed where available, read into memory elsewhere.
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+#if defined(PIXEL_SUM_HAS_MMAP)
+        const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0) {
+            throw std::runtime_error("Cannot open table file " + path.string());
+        }
+        struct stat status {};
+        if (::fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+            ::close(descriptor);
+            throw std::runtime_error("Cannot map table file " + path.string());
+        }
+        size_ = static_cast<std::size_t>(status.st_size);
+        void* address = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, descriptor, 0);
+        ::close(descriptor);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Cannot map table file " + path.string());
+        }
+        address_ = address;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Cannot open table file " + path.string());
+        }
+        contents_.resize(static_cast<std::size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(contents_.data()), static_cast<std::streamsize>(contents_.size()));
+        size_ = contents_.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if defined(PIXEL_SUM_HAS_MMAP)
+        ::munmap(address_, size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    [[nodiscard]] const std::byte* data() const noexcept
+    {
+#if defined(PIXEL_SUM_HAS_MMAP)
+        return static_cast<const std::byte*>(address_);
+#else
+        return contents_.data();
+#endif
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+private:
+#if defined(PIXEL_SUM_HAS_MMAP)
+    void* address_{nullptr};
+#else
+    std::vector<std::byte> contents_;
+#endif
+    std::size_t size_{0};
+};
+
+// Indices of the PixelSumCounters fields, in declaration order.
+enum class Counter : std::size_t {
+    SumQueries,
+    NonZeroCountQueries,
+    AverageQueries,
+    NonZeroAverageQueries,
+    VarianceQueries,
+    NonZeroVarianceQueries,
+    HistogramQueries,
+    PercentileQueries,
+    RotatedQueries,
+    BatchWindows,
+    ClampedWindows,
+    EmptyWindows,
+    Builds,
+    BuildNanoseconds,
+    BuildBytes,
+    // The live counters are gauges and survive resetPixelSumCounters().
+    LiveInstances,
+    LiveBytes,
+};
+
+constexpr std::pair<const char*, std::uint64_t PixelSumCounters::*> kCounterFields[] = {
+    { "sum_queries", &PixelSumCounters::sum_queries },
+    { "nonzero_count_queries", &PixelSumCounters::nonzero_count_queries },
+    { "average_queries", &PixelSumCounters::average_queries },
+    { "nonzero_average_queries", &PixelSumCounters::nonzero_average_queries },
+    { "variance_queries", &PixelSumCounters::variance_queries },
+    { "nonzero_variance_queries", &PixelSumCounters::nonzero_variance_queries },
+    { "histogram_queries", &PixelSumCounters::histogram_queries },
+    { "percentile_queries", &PixelSumCounters::percentile_queries },
+    { "rotated_queries", &PixelSumCounters::rotated_queries },
+    { "batch_windows", &PixelSumCounters::batch_windows },
+    { "clamped_windows", &PixelSumCounters::clamped_windows },
+    { "empty_windows", &PixelSumCounters::empty_windows },
+    { "builds", &PixelSumCounters::builds },
+    { "build_nanoseconds", &PixelSumCounters::build_nanoseconds },
+    { "build_bytes", &PixelSumCounters::build_bytes },
+    { "live_instances", &PixelSumCounters::live_instances },
+    { "live_bytes", &PixelSumCounters::live_bytes },
+};
+constexpr std::size_t kCounterCount = std::size(kCounterFields);
+using CounterValues = std::array<std::uint64_t, kCounterCount>;
+
+#if PIXEL_SUM_ENABLE_STATS
+// One thread's counters. Only the owning thread writes them; readers may see a slightly stale value.
+struct ThreadCounters {
+    std::array<std::atomic<std::uint64_t>, kCounterCount> values{};
+};
+
+// Every running thread's counters, plus the totals of the threads that have exited.
+struct CounterRegistry {
+    std::mutex mutex;
+    std::vector<const ThreadCounters*> threads;
+    CounterValues retired{};
+    // Totals at the last resetPixelSumCounters(), subtracted from every snapshot.
+    CounterValues baseline{};
+};
+
+CounterRegistry& counterRegistry()
+{
+    // Never destroyed, so threads exiting during static destruction can still retire their counters.
+    static auto* registry = new CounterRegistry;
+    return *registry;
+}
+
+struct ThreadCounterSlot {
+    ThreadCounterSlot()
+    {
+        CounterRegistry& registry = counterRegistry();
+        const std::lock_guard lock(registry.mutex);
+        registry.threads.push_back(&counters);
+    }
+
+    ~ThreadCounterSlot()
+    {
+        CounterRegistry& registry = counterRegistry();
+        const std::lock_guard lock(registry.mutex);
+        for (std::size_t i = 0; i < kCounterCount; ++i) {
+            registry.retired[i] += counters.values[i].load(std::memory_order_relaxed);
+        }
+        std::erase(registry.threads, &counters);
+    }
+
+    ThreadCounterSlot(const ThreadCounterSlot&) = delete;
+    ThreadCounterSlot(ThreadCounterSlot&&) = delete;
+    ThreadCounterSlot& operator=(const ThreadCounterSlot&) = delete;
+    ThreadCounterSlot& operator=(ThreadCounterSlot&&) = delete;
+
+    ThreadCounters counters;
+};
+
+void addCounter(Counter counter, std::uint64_t amount = 1) noexcept
+{
+    thread_local ThreadCounterSlot slot;
+    auto& value = slot.counters.values[static_cast<std::size_t>(counter)];
+    // A plain load and store instead of fetch_add: no other thread writes this counter, so no locked instruction
+    // is needed on the query path.
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Totals since the process started; the caller holds the registry mutex.
+CounterValues totalCounters(const CounterRegistry& registry)
+{
+    CounterValues totals = registry.retired;
+    for (const ThreadCounters* thread : registry.threads) {
+        for (std::size_t i = 0; i < kCounterCount; ++i) {
+            totals[i] += thread->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+// Gauges go down by wrapping around; the per-thread parts add up to the right total modulo 2^64.
+void subtractCounter(Counter counter, std::uint64_t amount = 1) noexcept
+{
+    addCounter(counter, std::uint64_t{0} - amount);
+}
+#else
+void addCounter(Counter /*counter*/, std::uint64_t /*amount*/ = 1) noexcept {}
+#endif
+} // namespace
+
+PixelSumCounters pixelSumCounters()
+{
+    PixelSumCounters counters{};
+#if PIXEL_SUM_ENABLE_STATS
+    CounterRegistry& registry = counterRegistry();
+    const std::lock_guard lock(registry.mutex);
+    const CounterValues totals = totalCounters(registry);
+    for (std::size_t i = 0; i < kCounterCount; ++i) {
+        counters.*kCounterFields[i].second = totals[i] - registry.baseline[i];
+    }
+#endif
+    return counters;
+}
+
+void resetPixelSumCounters()
+{
+#if PIXEL_SUM_ENABLE_STATS
+    CounterRegistry& registry = counterRegistry();
+    const std::lock_guard lock(registry.mutex);
+    registry.baseline = totalCounters(registry);
+    for (const auto counter : { Counter::LiveInstances, Counter::LiveBytes }) {
+        registry.baseline[static_cast<std::size_t>(counter)] = 0;
+    }
+#endif
+}
+
+void writePixelSumCounters(std::ostream& out, const PixelSumCounters& counters)
+{
+    for (const auto& [name, field] : kCounterFields) {
+        out << "pixel_sum_" << name << ' ' << counters.*field << '\n';
+    }
+}
+
+#if PIXEL_SUM_ENABLE_STATS
+PixelSumLiveStats::PixelSumLiveStats() noexcept
+{
+    addCounter(Counter::LiveInstances);
+}
+
+PixelSumLiveStats::~PixelSumLiveStats()
+{
+    subtractCounter(Counter::LiveInstances);
+    subtractCounter(Counter::LiveBytes, bytes_);
+}
+
+PixelSumLiveStats::PixelSumLiveStats(const PixelSumLiveStats& other) noexcept
+    : bytes_(other.bytes_)
+    , build_nanoseconds_(other.build_nanoseconds_)
+{
+    addCounter(Counter::LiveInstances);
+    addCounter(Counter::LiveBytes, bytes_);
+}
+
+// The moved-from PixelSum gives up its tables, so its bytes move along with them.
+PixelSumLiveStats::PixelSumLiveStats(PixelSumLiveStats&& other) noexcept
+    : bytes_(std::exchange(other.bytes_, 0))
+    , build_nanoseconds_(other.build_nanoseconds_)
+{
+    addCounter(Counter::LiveInstances);
+}
+
+PixelSumLiveStats& PixelSumLiveStats::operator=(const PixelSumLiveStats& other) noexcept
+{
+    track(other.bytes_);
+    build_nanoseconds_ = other.build_nanoseconds_;
+    return *this;
+}
+
+PixelSumLiveStats& PixelSumLiveStats::operator=(PixelSumLiveStats&& other) noexcept
+{
+    if (this != &other) {
+        subtractCounter(Counter::LiveBytes, bytes_);
+        bytes_ = std::exchange(other.bytes_, 0);
+        build_nanoseconds_ = other.build_nanoseconds_;
+    }
+    return *this;
+}
+
+void PixelSumLiveStats::track(std::uint64_t bytes) noexcept
+{
+    addCounter(Counter::LiveBytes, bytes - bytes_);
+    bytes_ = bytes;
+}
+#endif
+
+template <typename T, typename S>
+struct PixelSum<T, S>::MappedTables {
+    explicit MappedTables(const std::filesystem::path& path)
+        : file(path)
+    {
+    }
+
+    MappedFile file;
+    const S* sum{nullptr};
+    const S* nonzero{nullptr};
+};
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(const T* buffer, int width, int height)
+    : PixelSum(buffer, width, height, PixelSumOptions{})
+{
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(std::span<const T> buffer, int width, int height)
+    : PixelSum(buffer, width, height, PixelSumOptions{})
+{
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(const T* buffer, int width, int height, const PixelSumOptions& options)
+    : PixelSum(std::span<const T>(buffer, static_cast<std::size_t>(width) * static_cast<std::size_t>(height)),
+               width,
+               height,
+               options)
+{
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(std::span<const T> buffer, int width, int height, const PixelSumOptions& options)
+    : PixelSum(packedImage(buffer, width, height), options)
+{
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(const PixelSumImage<T>& image)
+    : PixelSum(image, PixelSumOptions{})
+{
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::PixelSum(const PixelSumImage<T>& image, const PixelSumOptions& options)
+    : layout_(options.layout == PixelSumLayout::Auto ? autoLayout(image) : options.layout)
+    , with_squares_(options.with_squares)
+    , with_rotated_(options.with_rotated)
+    , build_lazily_(options.lazy)
+    , thread_count_(options.thread_count > 0 ? options.thread_count : std::max(1U, std::thread::hardware_concurrency()))
+    , tables_(layout_ == PixelSumLayout::RowMajor ? options.tables : PixelSumTables::All)
+{
+    if (options.tables == PixelSumTables::None) {
+        throw std::runtime_error("At least one of the sum and non-zero tables is needed");
+    }
+    if ((options.tables & ~PixelSumTables::All) != PixelSumTables::None) {
+        throw std::runtime_error("PixelSumOptions::tables only selects the sum and non-zero tables");
+    }
+
+    configureHistogram(options);
+    rebuild(image);
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::rebuild(std::span<const T> buffer)
+{
+    rebuild(buffer, width_, height_);
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::rebuild(std::span<const T> buffer, int width, int height)
+{
+    rebuild(packedImage(buffer, width, height));
+}
+
+template <typename T, typename S>
+PixelSumImage<T> PixelSum<T, S>::packedImage(std::span<const T> buffer, int width, int height)
+{
+    if (!isRepresentable(width, height)) {
+        throw std::runtime_error("Dimension is out of bound");
+    }
+
+    if (buffer.size() < static_cast<std::size_t>(width) * static_cast<std::size_t>(height)) {
+        throw std::runtime_error("Buffer size is smaller than width*height");
+    }
+    return PixelSumImage<T>{ buffer.data(), width, height, static_cast<std::size_t>(width) };
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::rebuild(const PixelSumImage<T>& image)
+{
+    std::chrono::steady_clock::time_point build_start{};
+    if constexpr (pixelSumStatsEnabled()) {
+        build_start = std::chrono::steady_clock::now();
+    }
+
+    const int width = image.width;
+    const int height = image.height;
+    if (!isRepresentable(width, height)) {
+        throw std::runtime_error("Dimension is out of bound");
+    }
+
+    if (image.stride < static_cast<std::size_t>(width)) {
+        throw std::runtime_error("Row stride is smaller than width");
+    }
+
+    const auto dimension = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+
+    constexpr auto kMaxSquare = static_cast<std::uint64_t>(std::numeric_limits<T>::max()) * std::numeric_limits<T>::max();
+    if (with_squares_ && static_cast<std::uint64_t>(dimension) > std::numeric_limits<std::uint64_t>::max() / kMaxSquare) {
+        throw std::runtime_error("Dimension is out of bound for the sum-of-squares table");
+    }
+
+    if (histogramBins() > 0 && dimension > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Dimension is out of bound for the histogram counters");
+    }
+
+    width_ = width;
+    height_ = height;
+    mapping_.reset();
+    // The new pixels replace whatever was staged for the old ones.
+    deferred_.region = PixelSumWindow{ 0, 0, -1, -1 };
+
+    // A lazy object keeps the pixels until its tables are built; RowMajor and optional tables not built now are left
+    // empty, which is how readers tell them apart. clear() keeps the capacity, so a later build reuses it.
+    const PixelSumTables requested = tables_ | optionalTables();
+    const PixelSumTables built = build_lazily_ ? PixelSumTables::None : requested;
+    lazy_.source = build_lazily_ ? image : PixelSumImage<T>{};
+    lazy_.pending.store(build_lazily_ ? requested : PixelSumTables::None, std::memory_order_relaxed);
+    const auto clear_unbuilt = [built](PixelSumTables table, auto& data) {
+        if ((built & table) == PixelSumTables::None) {
+            data.clear();
+        }
+    };
+    clear_unbuilt(PixelSumTables::Sum, summed_data_);
+    clear_unbuilt(PixelSumTables::NonZero, nonzero_data_);
+    clear_unbuilt(PixelSumTables::Squares, squares_data_);
+    clear_unbuilt(PixelSumTables::Rotated, rotated_data_);
+    clear_unbuilt(PixelSumTables::Rotated, rotated_diagonals_);
+    clear_unbuilt(PixelSumTables::Histogram, histogram_data_);
+
+    buildParts(image, built);
+
+    if constexpr (pixelSumStatsEnabled()) {
+        const auto nanoseconds = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - build_start).count());
+        const auto bytes = ownedBytes();
+        addCounter(Counter::Builds);
+        addCounter(Counter::BuildNanoseconds, nanoseconds);
+        addCounter(Counter::BuildBytes, bytes);
+        live_stats_.recordBuild(nanoseconds);
+        live_stats_.track(bytes);
+    }
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::buildTables(const PixelSumImage<T>& source, PixelSumTables tables, std::span<std::uint64_t> squares)
+{
+    const auto dimension = static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_);
+    switch (layout_) {
+    case PixelSumLayout::Fenwick:
+        buildFenwick(source);
+        return;
+    case PixelSumLayout::Sparse:
+        buildSparse(source);
+        return;
+    case PixelSumLayout::Compact: {
+        using Geometry = BlockGeometry<CompactSum>;
+        const Geometry geometry(width_);
+        compact_base_.resize(geometry.blocks(height_) * Geometry::kBaseEntries);
+        compact_sum_.resize(geometry.blocks(height_) * Geometry::kBlockEntries);
+        compact_nonzero_.resize(geometry.blocks(height_) * Geometry::kBlockEntries);
+        break;
+    }
+    case PixelSumLayout::Tiled:
+        tiled_data_.resize(TileGeometry<S>(width_).size(height_));
+        break;
+    case PixelSumLayout::RowMajor:
+    default:
+        if ((tables & PixelSumTables::Sum) != PixelSumTables::None) {
+            summed_data_.resize(dimension);
+        }
+        if ((tables & PixelSumTables::NonZero) != PixelSumTables::None) {
+            nonzero_data_.resize(dimension);
+        }
+        break;
+    }
+
+    withSinkFactory(stripCount(height_, thread_count_), tables, [&](const auto& make_sink) {
+        buildIntegralImagesParallel<T, S>(source, thread_count_, make_sink, squares);
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::buildParts(const PixelSumImage<T>& source, PixelSumTables tables)
+{
+    // Every entry read later is overwritten by the build, so resize() only has to allocate when the tables grow.
+    const auto dimension = static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_);
+    if ((tables & PixelSumTables::Rotated) != PixelSumTables::None) {
+        rotated_data_.resize(dimension);
+        rotated_diagonals_.assign(2 * (static_cast<std::size_t>(width_) + height_ - 1), S{});
+        const auto pixel = [&source](int x, int y) { return static_cast<S>(source.row(y)[x]); };
+        accumulateDiagonals<S>(width_, height_, PixelSumWindow{ 0, 0, width_ - 1, height_ - 1 }, pixel, rotated_diagonals_.data());
+        accumulateCones<S>(DiagonalSums<S>{ rotated_diagonals_.data(), width_, height_ }, 0, height_, coneRows(), pixel, [&](int y, const S* row) {
+            std::copy_n(row, static_cast<std::size_t>(width_), rotated_data_.data() + static_cast<std::size_t>(y) * static_cast<std::size_t>(width_));
+        });
+    }
+
+    if ((tables & PixelSumTables::Histogram) != PixelSumTables::None) {
+        histogram_data_.resize(dimension * histogramBins());
+        buildHistogram(source);
+    }
+
+    // The squares ride along with the integral image passes when those run too.
+    const PixelSumTables integral = tables & PixelSumTables::All;
+    const bool with_squares = (tables & PixelSumTables::Squares) != PixelSumTables::None;
+    const bool fused_squares = with_squares && integral != PixelSumTables::None && layout_ != PixelSumLayout::Fenwick &&
+                               layout_ != PixelSumLayout::Sparse;
+    if (with_squares) {
+        squares_data_.resize(dimension);
+    }
+    if (with_squares && !fused_squares) {
+        buildSquares(source);
+    }
+    if (integral != PixelSumTables::None) {
+        buildTables(source, integral, fused_squares ? std::span<std::uint64_t>(squares_data_) : std::span<std::uint64_t>{});
+    }
+}
+
+template <typename T, typename S>
+PixelSumTables PixelSum<T, S>::optionalTables() const noexcept
+{
+    return (with_squares_ ? PixelSumTables::Squares : PixelSumTables::None) |
+           (with_rotated_ ? PixelSumTables::Rotated : PixelSumTables::None) |
+           (histogramBins() > 0 ? PixelSumTables::Histogram : PixelSumTables::None);
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::buildSquares(const PixelSumImage<T>& source)
+{
+    const auto row = static_cast<std::size_t>(width_);
+    std::uint64_t* squares = squares_data_.data();
+    for (std::size_t y = 0; y < static_cast<std::size_t>(height_); ++y) {
+        accumulateSquares(source.row(static_cast<int>(y)), width_, y > 0 ? squares + (y - 1) * row : nullptr, squares + y * row);
+    }
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::ensureTables(PixelSumTables needed) const
+{
+    if ((needed & ~(tables_ | optionalTables())) != PixelSumTables::None) {
+        throw std::runtime_error("Table was not requested in PixelSumOptions::tables");
+    }
+    if ((lazy_.pending.load(std::memory_order_acquire) & needed) == PixelSumTables::None) {
+        return;
+    }
+
+    const std::lock_guard lock(lazy_.mutex);
+    const PixelSumTables pending = lazy_.pending.load(std::memory_order_relaxed);
+    if ((pending & needed) == PixelSumTables::None) {
+        return;
+    }
+
+    // Only RowMajor keeps the integral images apart; the other layouts build both at once. Optional tables are built
+    // one by one.
+    PixelSumTables build = pending & needed;
+    if (layout_ != PixelSumLayout::RowMajor && (build & PixelSumTables::All) != PixelSumTables::None) {
+        build = build | (pending & PixelSumTables::All);
+    }
+    // Building a pending table is logically const, like flushing staged updates; readers of other tables never
+    // touch what is written here.
+    auto* self = const_cast<PixelSum*>(this); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    self->buildParts(lazy_.source, build);
+    self->live_stats_.track(ownedBytes());
+
+    const PixelSumTables remaining = pending & ~build;
+    if (remaining == PixelSumTables::None) {
+        lazy_.source = PixelSumImage<T>{};
+    }
+    lazy_.pending.store(remaining, std::memory_order_release);
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getPixelSum(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::SumQueries);
+    ensureTables(PixelSumTables::Sum);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
+    }
+
+    return getSummedArea(Table::Sum, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getPixelAverage(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::AverageQueries);
+    ensureTables(PixelSumTables::Sum);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    const auto sum = static_cast<double>(getSummedArea(Table::Sum, x0, y0, x1, y1));
+    return count > 0.0 ? (sum / count) : 0.0;
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getNonZeroCount(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::NonZeroCountQueries);
+    ensureTables(PixelSumTables::NonZero);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
+    }
+
+    return getSummedArea(Table::NonZero, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getNonZeroAverage(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::NonZeroAverageQueries);
+    ensureTables(PixelSumTables::All);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    const auto sum = static_cast<double>(getSummedArea(Table::Sum, x0, y0, x1, y1));
+    const auto count = getSummedArea(Table::NonZero, x0, y0, x1, y1);
+    return count > S{} ? (sum / static_cast<double>(count)) : 0.0;
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getPixelSumUnchecked(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::SumQueries);
+    ensureTables(PixelSumTables::Sum);
+    flushDeferred();
+    return getSummedArea(Table::Sum, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getPixelAverageUnchecked(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::AverageQueries);
+    ensureTables(PixelSumTables::Sum);
+    flushDeferred();
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    return static_cast<double>(getSummedArea(Table::Sum, x0, y0, x1, y1)) / count;
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getNonZeroCountUnchecked(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::NonZeroCountQueries);
+    ensureTables(PixelSumTables::NonZero);
+    flushDeferred();
+    return getSummedArea(Table::NonZero, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getNonZeroAverageUnchecked(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::NonZeroAverageQueries);
+    ensureTables(PixelSumTables::All);
+    flushDeferred();
+    const auto sum = static_cast<double>(getSummedArea(Table::Sum, x0, y0, x1, y1));
+    const auto count = getSummedArea(Table::NonZero, x0, y0, x1, y1);
+    return count > S{} ? (sum / static_cast<double>(count)) : 0.0;
+}
+
+namespace {
+// Variance of `count` values from their sum and sum of squares, as (count * squares - sum^2) / count^2 in exact
+// integer arithmetic where a 128-bit type exists, since the usual squares / count - mean^2 cancels badly.
+template <typename S>
+double windowVariance(std::uint64_t count, S sum, std::uint64_t squares)
+{
+    if (count == 0) {
+        return 0.0;
+    }
+#if defined(__SIZEOF_INT128__)
+    __extension__ using Wide = unsigned __int128;
+    const Wide numerator = static_cast<Wide>(count) * squares - static_cast<Wide>(sum) * sum;
+    const auto count_value = static_cast<double>(count);
+    return static_cast<double>(numerator) / (count_value * count_value);
+#else
+    const double mean = static_cast<double>(sum) / static_cast<double>(count);
+    return std::max(0.0, static_cast<double>(squares) / static_cast<double>(count) - mean * mean);
+#endif
+}
+} // namespace
+
+template <typename T, typename S>
+double PixelSum<T, S>::getPixelVariance(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::VarianceQueries);
+    if (!with_squares_) {
+        throw std::runtime_error("Sum-of-squares table is not enabled");
+    }
+    ensureTables(PixelSumTables::Sum | PixelSumTables::Squares);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    const auto count = static_cast<std::uint64_t>(x1 - x0 + 1) * static_cast<std::uint64_t>(y1 - y0 + 1);
+    return windowVariance<S>(count, getSummedArea(Table::Sum, x0, y0, x1, y1), getSquaresSum(x0, y0, x1, y1));
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getPixelStdDev(int x0, int y0, int x1, int y1) const
+{
+    return std::sqrt(getPixelVariance(x0, y0, x1, y1));
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getNonZeroVariance(int x0, int y0, int x1, int y1) const
+{
+    addCounter(Counter::NonZeroVarianceQueries);
+    if (!with_squares_) {
+        throw std::runtime_error("Sum-of-squares table is not enabled");
+    }
+    ensureTables(PixelSumTables::All | PixelSumTables::Squares);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    // Zero pixels add nothing to the sum of squares, so the full-window squares serve the non-zero pixels too.
+    return windowVariance<S>(static_cast<std::uint64_t>(getSummedArea(Table::NonZero, x0, y0, x1, y1)),
+                             getSummedArea(Table::Sum, x0, y0, x1, y1),
+                             getSquaresSum(x0, y0, x1, y1));
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getNonZeroStdDev(int x0, int y0, int x1, int y1) const
+{
+    return std::sqrt(getNonZeroVariance(x0, y0, x1, y1));
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::getHistogram(int x0, int y0, int x1, int y1, std::span<S> histogram) const
+{
+    addCounter(Counter::HistogramQueries);
+    histogramOf(x0, y0, x1, y1, histogram);
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::histogramOf(int x0, int y0, int x1, int y1, std::span<S> histogram) const
+{
+    const std::size_t bins = histogramBins();
+    if (bins == 0) {
+        throw std::runtime_error("Histogram is not enabled");
+    }
+    if (histogram.size() < bins) {
+        throw std::runtime_error("Histogram size is smaller than the bin count");
+    }
+
+    ensureTables(PixelSumTables::Histogram);
+    flushDeferred();
+    normalizeBounds(x0, y0, x1, y1);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        std::fill_n(histogram.begin(), bins, S{});
+        return;
+    }
+
+    // d - b - c + a lane by lane, each corner being the bin counts of one prefix window. The counters wrap at 32 bits,
+    // which is exact since no window holds more than width * height < 2^32 pixels.
+    const auto corner = [this, bins](int x, int y) -> const std::uint32_t* {
+        return x >= 0 && y >= 0 ? histogram_data_.data() + indexOf(x, y, width_) * bins : nullptr;
+    };
+    const std::uint32_t* d = corner(x1, y1);
+    const std::uint32_t* b = corner(x1, y0 - 1);
+    const std::uint32_t* c = corner(x0 - 1, y1);
+    const std::uint32_t* a = corner(x0 - 1, y0 - 1);
+    for (std::size_t bin = 0; bin < bins; ++bin) {
+        std::uint32_t count = d[bin];
+        count -= b != nullptr ? b[bin] : 0U;
+        count -= c != nullptr ? c[bin] : 0U;
+        count += a != nullptr ? a[bin] : 0U;
+        histogram[bin] = static_cast<S>(count);
+    }
+}
+
+template <typename T, typename S>
+double PixelSum<T, S>::getPercentile(int x0, int y0, int x1, int y1, double percentile) const
+{
+    addCounter(Counter::PercentileQueries);
+    const std::size_t bins = histogramBins();
+    if (bins == 0) {
+        throw std::runtime_error("Histogram is not enabled");
+    }
+
+    // Bin counts of up to kStackBins bins stay on the stack.
+    constexpr std::size_t kStackBins = 256;
+    S stack_counts[kStackBins];
+    std::vector<S> heap_counts(bins > kStackBins ? bins : 0);
+    const std::span<S> counts = bins > kStackBins ? std::span<S>(heap_counts) : std::span<S>(stack_counts, bins);
+    histogramOf(x0, y0, x1, y1, counts);
+
+    S total{};
+    for (const S count : counts) {
+        total += count;
+    }
+    if (total == S{}) {
+        return 0.0;
+    }
+
+    const double rank = std::clamp(percentile, 0.0, 100.0) / 100.0 * static_cast<double>(total);
+    double below = 0.0;
+    for (std::size_t b = 0; b < bins; ++b) {
+        const auto count = static_cast<double>(counts[b]);
+        if (count > 0.0 && below + count >= rank) {
+            const auto low = static_cast<double>(histogram_edges_[b]);
+            const auto high = static_cast<double>(histogram_edges_[b + 1]);
+            return low + (rank - below) / count * (high - low);
+        }
+        below += count;
+    }
+    return static_cast<double>(histogram_edges_[bins]);
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getRotatedSum(int x, int y, int w, int h) const
+{
+    addCounter(Counter::RotatedQueries);
+    if (!with_rotated_) {
+        throw std::runtime_error("Rotated table is not enabled");
+    }
+    if (w < 0 || h < 0) {
+        throw std::runtime_error("Rotated window size is negative");
+    }
+
+    ensureTables(PixelSumTables::Rotated);
+    flushDeferred();
+    if (w == 0 || h == 0) {
+        addCounter(Counter::EmptyWindows);
+        return S{};
+    }
+
+    // The rectangle is the diagonal quadrant difference x + y <= p < x + y + 2w, y - x <= q < y - x + 2h.
+    const long long cx = x;
+    const long long cy = y;
+    if constexpr (pixelSumStatsEnabled()) {
+        // Its pixels span [x - h + 1, x + w - 1] x [y, y + w + h - 1], which clampBounds() counts like an upright window.
+        const auto bound = [](long long value) {
+            return static_cast<int>(std::clamp<long long>(value, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()));
+        };
+        int x0 = bound(cx - h + 1);
+        int y0 = y;
+        int x1 = bound(cx + w - 1);
+        int y1 = bound(cy + w + h - 1);
+        static_cast<void>(clampBounds(x0, y0, x1, y1));
+    }
+    return rotatedCone(cx + w - h, cy + w + h - 1) - rotatedCone(cx - h, cy + h - 1) - rotatedCone(cx + w, cy + w - 1) +
+           rotatedCone(cx, cy - 1);
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::rotatedCone(long long x, long long y) const noexcept
+{
+    const DiagonalSums<S> diagonals{ rotated_diagonals_.data(), width_, height_ };
+    if (y < 0) {
+        return S{};
+    }
+    if (x < 0) {
+        return diagonals.byP(x + y);
+    }
+    if (x >= width_) {
+        return diagonals.byQ(y - x);
+    }
+    if (y >= height_) {
+        return diagonals.byP(x + y) + diagonals.byQ(y - x) - diagonals.total();
+    }
+    return rotated_data_[indexOf(static_cast<int>(x), static_cast<int>(y), width_)];
+}
+
+template <typename T, typename S>
+std::uint64_t PixelSum<T, S>::getSquaresSum(int x0, int y0, int x1, int y1) const noexcept
+{
+    const std::uint64_t* squares = squares_data_.data();
+    return summedArea<std::uint64_t>(
+        [squares, this](int x, int y) { return squares[indexOf(x, y, width_)]; }, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::getWindowStats(std::span<const PixelSumWindow> windows, std::span<PixelSumStats<S>> results) const
+{
+    if (results.size() < windows.size()) {
+        throw std::runtime_error("Result size is smaller than window size");
+    }
+
+    addCounter(Counter::BatchWindows, windows.size());
+    ensureTables(PixelSumTables::All);
+    flushDeferred();
+    withCornerReader([&](const auto& read_corner) { gatherWindowStats(windows, results, read_corner); });
+}
+
+template <typename T, typename S>
+template <typename CornerReader>
+void PixelSum<T, S>::gatherWindowStats(std::span<const PixelSumWindow> windows,
+                                       std::span<PixelSumStats<S>> results,
+                                       const CornerReader& read_corner) const
+{
+    // Windows are processed in blocks: corners of both tables are gathered side by side ([sum, nonzero] per window),
+    // combined with one vectorized pass, and only then turned into averages.
+    constexpr std::size_t kBlock = 16;
+    S d[2 * kBlock];
+    S b[2 * kBlock];
+    S c[2 * kBlock];
+    S a[2 * kBlock];
+    S area[2 * kBlock];
+    double count[kBlock];
+
+    for (std::size_t begin = 0; begin < windows.size(); begin += kBlock) {
+        const std::size_t size = std::min(kBlock, windows.size() - begin);
+
+        for (std::size_t i = 0; i < size; ++i) {
+            auto [x0, y0, x1, y1] = windows[begin + i];
+            normalizeBounds(x0, y0, x1, y1);
+
+            S* corners[] = { d + 2 * i, b + 2 * i, c + 2 * i, a + 2 * i };
+            for (S* corner : corners) {
+                corner[0] = S{};
+                corner[1] = S{};
+            }
+
+            if (!clampBounds(x0, y0, x1, y1)) {
+                count[i] = 0.0;
+                continue;
+            }
+            count[i] = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+
+            read_corner(x1, y1, corners[0]);
+            if (y0 > 0) {
+                read_corner(x1, y0 - 1, corners[1]);
+            }
+            if (x0 > 0) {
+                read_corner(x0 - 1, y1, corners[2]);
+            }
+            if (x0 > 0 && y0 > 0) {
+                read_corner(x0 - 1, y0 - 1, corners[3]);
+            }
+        }
+
+        combineCorners<S>(d, b, c, a, area, 2 * size);
+
+        for (std::size_t i = 0; i < size; ++i) {
+            auto& result = results[begin + i];
+            result.sum = area[2 * i];
+            result.nonzero_count = area[2 * i + 1];
+
+            const auto sum = static_cast<double>(result.sum);
+            result.pixel_average = count[i] > 0.0 ? (sum / count[i]) : 0.0;
+            result.nonzero_average = result.nonzero_count > S{} ? (sum / static_cast<double>(result.nonzero_count)) : 0.0;
+        }
+    }
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::boxFilter(int radius, PixelSumStatistic statistic, std::span<double> output) const
+{
+    if (output.size() < static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_)) {
+        throw std::runtime_error("Output size is smaller than width*height");
+    }
+
+    const int columns_radius = std::min(std::max(radius, 0), width_);
+    const auto width = static_cast<std::size_t>(width_);
+    const bool with_sum = statistic != PixelSumStatistic::NonZeroCount;
+    const bool with_nonzero = statistic == PixelSumStatistic::NonZeroCount || statistic == PixelSumStatistic::NonZeroAverage;
+
+    filterWindows(radius, with_sum, with_nonzero, [&](int y, const S* sum, const S* nonzero, int rows) {
+        double* target = output.data() + static_cast<std::size_t>(y) * width;
+        switch (statistic) {
+        case PixelSumStatistic::Sum:
+            std::transform(sum, sum + width, target, [](S value) { return static_cast<double>(value); });
+            break;
+        case PixelSumStatistic::NonZeroCount:
+            std::transform(nonzero, nonzero + width, target, [](S value) { return static_cast<double>(value); });
+            break;
+        case PixelSumStatistic::Average:
+            for (int x = 0; x < width_; ++x) {
+                const int columns = std::min(x + columns_radius, width_ - 1) - std::max(x - columns_radius, 0) + 1;
+                const auto count = static_cast<double>(columns) * static_cast<double>(rows);
+                target[x] = static_cast<double>(sum[x]) / count;
+            }
+            break;
+        case PixelSumStatistic::NonZeroAverage:
+        default:
+            for (std::size_t x = 0; x < width; ++x) {
+                target[x] = nonzero[x] > S{} ? (static_cast<double>(sum[x]) / static_cast<double>(nonzero[x])) : 0.0;
+            }
+            break;
+        }
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::boxFilter(int radius, PixelSumStatistic statistic, std::span<S> output) const
+{
+    if (statistic != PixelSumStatistic::Sum && statistic != PixelSumStatistic::NonZeroCount) {
+        throw std::runtime_error("Averages need a floating-point output");
+    }
+    if (output.size() < static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_)) {
+        throw std::runtime_error("Output size is smaller than width*height");
+    }
+
+    const auto width = static_cast<std::size_t>(width_);
+    const bool with_sum = statistic == PixelSumStatistic::Sum;
+    filterWindows(radius, with_sum, !with_sum, [&](int y, const S* sum, const S* nonzero, int /*rows*/) {
+        std::copy_n(with_sum ? sum : nonzero, width, output.data() + static_cast<std::size_t>(y) * width);
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::gridFilter(int cell_width, int cell_height, PixelSumStatistic statistic, std::span<double> output, int levels) const
+{
+    if (output.size() < gridSize(cell_width, cell_height, levels)) {
+        throw std::runtime_error("Output size is smaller than the grid");
+    }
+
+    const bool with_sum = statistic != PixelSumStatistic::NonZeroCount;
+    const bool with_nonzero = statistic == PixelSumStatistic::NonZeroCount || statistic == PixelSumStatistic::NonZeroAverage;
+    gridWindows(cell_width, cell_height, levels, with_sum, with_nonzero, [&](std::size_t index, S sum, S nonzero, double area) {
+        switch (statistic) {
+        case PixelSumStatistic::Sum:
+            output[index] = static_cast<double>(sum);
+            break;
+        case PixelSumStatistic::NonZeroCount:
+            output[index] = static_cast<double>(nonzero);
+            break;
+        case PixelSumStatistic::Average:
+            output[index] = static_cast<double>(sum) / area;
+            break;
+        case PixelSumStatistic::NonZeroAverage:
+        default:
+            output[index] = nonzero > S{} ? (static_cast<double>(sum) / static_cast<double>(nonzero)) : 0.0;
+            break;
+        }
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::gridFilter(int cell_width, int cell_height, PixelSumStatistic statistic, std::span<S> output, int levels) const
+{
+    if (statistic != PixelSumStatistic::Sum && statistic != PixelSumStatistic::NonZeroCount) {
+        throw std::runtime_error("Averages need a floating-point output");
+    }
+    if (output.size() < gridSize(cell_width, cell_height, levels)) {
+        throw std::runtime_error("Output size is smaller than the grid");
+    }
+
+    const bool with_sum = statistic == PixelSumStatistic::Sum;
+    gridWindows(cell_width, cell_height, levels, with_sum, !with_sum, [&](std::size_t index, S sum, S nonzero, double /*area*/) {
+        output[index] = with_sum ? sum : nonzero;
+    });
+}
+
+template <typename T, typename S>
+std::size_t PixelSum<T, S>::gridSize(int cell_width, int cell_height, int levels) const
+{
+    if (cell_width <= 0 || cell_height <= 0) {
+        throw std::runtime_error("Cell size is not positive");
+    }
+    if (levels <= 0) {
+        throw std::runtime_error("Level count is not positive");
+    }
+
+    // A moved-from object has no cells.
+    if (width_ == 0 || height_ == 0) {
+        return 0;
+    }
+
+    std::size_t size = 0;
+    for (int level = 0; level < levels; ++level) {
+        const int cell_columns = gridCellSide(cell_width, level, width_);
+        const int cell_rows = gridCellSide(cell_height, level, height_);
+        size += static_cast<std::size_t>((width_ - 1) / cell_columns + 1) * static_cast<std::size_t>((height_ - 1) / cell_rows + 1);
+    }
+    return size;
+}
+
+// A cell's column sums over its rows, (x1, y1) - (x1, y0 - 1), are running along the cell row, so each cell is the
+// difference of two neighbouring ones: two table reads per cell, from the two integral image rows bounding the cell
+// row, instead of four reads plus the per-call normalization of the getters.
+template <typename T, typename S>
+template <typename Store>
+void PixelSum<T, S>::gridWindows(int cell_width, int cell_height, int levels, bool with_sum, bool with_nonzero, const Store& store) const
+{
+    ensureTables((with_sum ? PixelSumTables::Sum : PixelSumTables::None) | (with_nonzero ? PixelSumTables::NonZero : PixelSumTables::None));
+    flushDeferred();
+
+    // A table that was not requested is never read through its reader.
+    withTableReader(Table::Sum, [&](const auto& sum_at) {
+        withTableReader(Table::NonZero, [&](const auto& nonzero_at) {
+            const auto column_sums = [&](const auto& at, int x, int y0, int y1) { return at(x, y1) - (y0 > 0 ? at(x, y0 - 1) : S{}); };
+
+            std::size_t index = 0;
+            for (int level = 0; level < levels; ++level) {
+                const int cell_columns = gridCellSide(cell_width, level, width_);
+                const int cell_rows = gridCellSide(cell_height, level, height_);
+
+                for (int y0 = 0; y0 < height_; y0 += std::min(cell_rows, height_ - y0)) {
+                    const int y1 = y0 + std::min(cell_rows, height_ - y0) - 1;
+                    S previous_sum{};
+                    S previous_nonzero{};
+                    for (int x0 = 0; x0 < width_; x0 += std::min(cell_columns, width_ - x0)) {
+                        const int x1 = x0 + std::min(cell_columns, width_ - x0) - 1;
+                        const S sum = with_sum ? column_sums(sum_at, x1, y0, y1) : S{};
+                        const S nonzero = with_nonzero ? column_sums(nonzero_at, x1, y0, y1) : S{};
+                        store(index++,
+                              sum - previous_sum,
+                              nonzero - previous_nonzero,
+                              static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1));
+                        previous_sum = sum;
+                        previous_nonzero = nonzero;
+                    }
+                }
+            }
+        });
+    });
+}
+
+// Every output row is the difference of two integral image rows, which leaves per-column sums over the window's
+// rows; a second difference along the row gives the windows. Away from the left and right borders that is
+// d - b - c + a over contiguous runs, so it goes through combineCorners() instead of per-pixel clamping.
+template <typename T, typename S>
+template <typename Store>
+void PixelSum<T, S>::filterWindows(int radius, bool with_sum, bool with_nonzero, const Store& store) const
+{
+    if (radius < 0) {
+        throw std::runtime_error("Radius is negative");
+    }
+
+    ensureTables((with_sum ? PixelSumTables::Sum : PixelSumTables::None) | (with_nonzero ? PixelSumTables::NonZero : PixelSumTables::None));
+    flushDeferred();
+
+    const auto width = static_cast<std::size_t>(width_);
+    const int rows_radius = std::min(radius, height_);
+    const int columns_radius = std::min(radius, width_);
+    // Pixels in [interior_begin, interior_end) have their whole window inside the image horizontally.
+    const int interior_begin = std::min(columns_radius + 1, width_);
+    const int interior_end = std::max(interior_begin, width_ - columns_radius);
+
+    const unsigned int strips = std::min(thread_count_, static_cast<unsigned int>(height_));
+    parallelFor(strips, [&](unsigned int strip) {
+        // [bottom sum | bottom nonzero | top sum | top nonzero | window sum | window nonzero | zero row]; the row
+        // buffers are always written before they are read.
+        const std::span<S> buffer = threadScratch<S>(7 * width);
+        S* window_sum = buffer.data() + 4 * width;
+        S* window_nonzero = buffer.data() + 5 * width;
+        const S* zero = buffer.data() + 6 * width;
+        std::fill(buffer.begin() + static_cast<std::ptrdiff_t>(4 * width), buffer.end(), S{});
+
+        // Integral image row y as [sum, nonzero]; slot picks the buffer rows used for layouts without row storage.
+        const auto fetch = [&](int y, std::size_t slot) -> std::pair<const S*, const S*> {
+            if (y < 0) {
+                return { zero, zero };
+            }
+            if (layout_ == PixelSumLayout::RowMajor) {
+                // A table that was not requested is never read; the zero row stands in for it.
+                const std::size_t offset = static_cast<std::size_t>(y) * width;
+                const S* sum = rowMajorTable(Table::Sum);
+                const S* nonzero = rowMajorTable(Table::NonZero);
+                return { sum != nullptr ? sum + offset : zero, nonzero != nullptr ? nonzero + offset : zero };
+            }
+            S* row = buffer.data() + slot * 2 * width;
+            readRow(y, row, row + width);
+            return { row, row + width };
+        };
+
+        const auto difference = [&](const S* bottom, const S* top, S* target) {
+            for (int x = 0; x < interior_begin; ++x) {
+                const int right = std::min(x + columns_radius, width_ - 1);
+                const int left = x - columns_radius - 1;
+                target[x] = bottom[right] - top[right] - (left >= 0 ? bottom[left] - top[left] : S{});
+            }
+            if (interior_end > interior_begin) {
+                const auto begin = static_cast<std::size_t>(interior_begin);
+                const auto offset = static_cast<std::size_t>(columns_radius);
+                combineCorners<S>(bottom + begin + offset,
+                                  top + begin + offset,
+                                  bottom + begin - offset - 1,
+                                  top + begin - offset - 1,
+                                  target + begin,
+                                  static_cast<std::size_t>(interior_end - interior_begin));
+            }
+            for (int x = interior_end; x < width_; ++x) {
+                const int left = x - columns_radius - 1;
+                target[x] = bottom[width - 1] - top[width - 1] - (bottom[left] - top[left]);
+            }
+        };
+
+        const auto row_begin = static_cast<int>(static_cast<long long>(height_) * strip / strips);
+        const auto row_end = static_cast<int>(static_cast<long long>(height_) * (strip + 1) / strips);
+        for (int y = row_begin; y < row_end; ++y) {
+            const int y0 = std::max(y - rows_radius, 0);
+            const int y1 = std::min(y + rows_radius, height_ - 1);
+            const auto [bottom_sum, bottom_nonzero] = fetch(y1, 0);
+            const auto [top_sum, top_nonzero] = fetch(y0 - 1, 1);
+            if (with_sum) {
+                difference(bottom_sum, top_sum, window_sum);
+            }
+            if (with_nonzero) {
+                difference(bottom_nonzero, top_nonzero, window_nonzero);
+            }
+            store(y, window_sum, window_nonzero, y1 - y0 + 1);
+        }
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::update(int x0, int y0, int x1, int y1, std::span<const T> pixels)
+{
+    deferUpdate(x0, y0, x1, y1, pixels);
+    flushUpdates();
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::deferUpdate(int x0, int y0, int x1, int y1, std::span<const T> pixels)
+{
+    normalizeBounds(x0, y0, x1, y1);
+    if (x0 < 0 || y0 < 0 || x1 >= width_ || y1 >= height_) {
+        throw std::runtime_error("Update window is out of bound");
+    }
+
+    const auto window_width = static_cast<std::size_t>(x1 - x0 + 1);
+    if (pixels.size() < window_width * static_cast<std::size_t>(y1 - y0 + 1)) {
+        throw std::runtime_error("Buffer size is smaller than the update window");
+    }
+    // The old pixel values are recovered from the sum table.
+    if ((tables_ & PixelSumTables::Sum) == PixelSumTables::None) {
+        throw std::runtime_error("Updates need the sum table");
+    }
+    if (layout_ == PixelSumLayout::Sparse) {
+        throw std::runtime_error("The Sparse layout does not support updates");
+    }
+
+    ensureTables(tables_ | optionalTables());
+    detachMapping();
+
+    // Grow the staged bounding box to cover the new window, carrying over the deltas staged so far.
+    auto& region = deferred_.region;
+    const bool empty = region.x0 > region.x1;
+    const PixelSumWindow grown = empty ? PixelSumWindow{ x0, y0, x1, y1 }
+                                       : PixelSumWindow{ std::min(region.x0, x0),
+                                                         std::min(region.y0, y0),
+                                                         std::max(region.x1, x1),
+                                                         std::max(region.y1, y1) };
+    const auto grown_width = static_cast<std::size_t>(grown.x1 - grown.x0 + 1);
+    const auto grown_index = [&grown, grown_width](int x, int y) -> std::size_t {
+        return static_cast<std::size_t>(y - grown.y0) * grown_width + static_cast<std::size_t>(x - grown.x0);
+    };
+
+    if (empty || grown.x0 != region.x0 || grown.y0 != region.y0 || grown.x1 != region.x1 || grown.y1 != region.y1) {
+        const std::size_t size = grown_width * static_cast<std::size_t>(grown.y1 - grown.y0 + 1);
+        std::vector<S> sum(size, S{});
+        std::vector<S> nonzero(size, S{});
+        std::vector<std::uint64_t> squares(with_squares_ ? size : 0, 0);
+        const std::size_t bins = histogramBins();
+        std::vector<std::uint32_t> histogram(size * bins, 0);
+        if (!empty) {
+            const auto region_width = static_cast<std::size_t>(region.x1 - region.x0 + 1);
+            for (int y = region.y0; y <= region.y1; ++y) {
+                const auto from = static_cast<std::size_t>(y - region.y0) * region_width;
+                std::copy_n(deferred_.sum.data() + from, region_width, sum.data() + grown_index(region.x0, y));
+                std::copy_n(deferred_.nonzero.data() + from, region_width, nonzero.data() + grown_index(region.x0, y));
+                if (with_squares_) {
+                    std::copy_n(deferred_.squares.data() + from, region_width, squares.data() + grown_index(region.x0, y));
+                }
+                std::copy_n(deferred_.histogram.data() + from * bins,
+                            region_width * bins,
+                            histogram.data() + grown_index(region.x0, y) * bins);
+            }
+        }
+        deferred_.region = grown;
+        deferred_.sum = std::move(sum);
+        deferred_.nonzero = std::move(nonzero);
+        deferred_.squares = std::move(squares);
+        deferred_.histogram = std::move(histogram);
+    }
+
+    // The current pixel value is the 1x1 window of the tables plus whatever is already staged for it.
+    withTableReader(Table::Sum, [&](const auto& at) {
+        for (int y = y0; y <= y1; ++y) {
+            const T* row = pixels.data() + static_cast<std::size_t>(y - y0) * window_width;
+            for (int x = x0; x <= x1; ++x) {
+                const std::size_t index = grown_index(x, y);
+                const S current = summedArea<S>(at, x, y, x, y) + deferred_.sum[index];
+                const S value = static_cast<S>(row[x - x0]);
+                deferred_.sum[index] += value - current;
+                deferred_.nonzero[index] += (value > S{} ? S{1} : S{0}) - (current > S{} ? S{1} : S{0});
+                if (with_squares_) {
+                    deferred_.squares[index] += static_cast<std::uint64_t>(value) * value - static_cast<std::uint64_t>(current) * current;
+                }
+                if (histogramBins() > 0) {
+                    std::uint32_t* bins = deferred_.histogram.data() + index * histogramBins();
+                    --bins[histogram_bin_of_[static_cast<std::size_t>(current)]];
+                    ++bins[histogram_bin_of_[static_cast<std::size_t>(value)]];
+                }
+            }
+        }
+    });
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::flushUpdates()
+{
+    const PixelSumWindow region = deferred_.region;
+    if (region.x0 > region.x1) {
+        return;
+    }
+
+    const auto region_width = static_cast<std::size_t>(region.x1 - region.x0 + 1);
+
+    if (layout_ == PixelSumLayout::Fenwick) {
+        const auto width = static_cast<std::size_t>(width_);
+        const auto height = static_cast<std::size_t>(height_);
+        for (int y = region.y0; y <= region.y1; ++y) {
+            for (int x = region.x0; x <= region.x1; ++x) {
+                const std::size_t index =
+                    static_cast<std::size_t>(y - region.y0) * region_width + static_cast<std::size_t>(x - region.x0);
+                const S sum = deferred_.sum[index];
+                const S nonzero = deferred_.nonzero[index];
+                if (sum == S{} && nonzero == S{}) {
+                    continue;
+                }
+                for (auto i = static_cast<std::size_t>(y) + 1; i <= height; i += i & (~i + 1)) {
+                    S* row = fenwick_data_.data() + (i - 1) * width * 2;
+                    for (auto j = static_cast<std::size_t>(x) + 1; j <= width; j += j & (~j + 1)) {
+                        row[2 * (j - 1)] += sum;
+                        row[2 * (j - 1) + 1] += nonzero;
+                    }
+                }
+            }
+        }
+    } else {
+        // Rows are re-read a whole alignment granule at a time, since re-committing the first row of a granule may
+        // change what the following rows decode to (Compact bases).
+        withSinkFactory(1U, tables_, [&](const auto& make_sink) {
+            auto sink = make_sink(0U);
+            constexpr int kAlignment = decltype(sink)::kRowAlignment;
+            const auto width = static_cast<std::size_t>(width_);
+
+            std::vector<S> granule(2 * width * static_cast<std::size_t>(kAlignment));
+            std::vector<S> previous(2 * width);
+            const S* previous_sum = nullptr;
+            const S* previous_nonzero = nullptr;
+            const int first = region.y0 - region.y0 % kAlignment;
+            if (first > 0) {
+                readRow(first - 1, previous.data(), previous.data() + width);
+                previous_sum = previous.data();
+                previous_nonzero = previous.data() + width;
+            }
+
+            // Column deltas accumulated over the rows seen so far.
+            std::vector<S> column_sum(region_width, S{});
+            std::vector<S> column_nonzero(region_width, S{});
+
+            for (int y = first; y < height_; ++y) {
+                const auto slot = static_cast<std::size_t>(y % kAlignment);
+                if (slot == 0) {
+                    for (int row = y; row < std::min(y + kAlignment, height_); ++row) {
+                        S* target = granule.data() + static_cast<std::size_t>(row - y) * 2 * width;
+                        readRow(row, target, target + width);
+                    }
+                }
+
+                const auto [sum, nonzero] = sink.row(y);
+                const S* stored = granule.data() + slot * 2 * width;
+                std::copy_n(stored, width, sum);
+                std::copy_n(stored + width, width, nonzero);
+
+                if (y >= region.y0) {
+                    if (y <= region.y1) {
+                        const auto offset = static_cast<std::size_t>(y - region.y0) * region_width;
+                        for (std::size_t x = 0; x < region_width; ++x) {
+                            column_sum[x] += deferred_.sum[offset + x];
+                            column_nonzero[x] += deferred_.nonzero[offset + x];
+                        }
+                    }
+
+                    S row_sum{};
+                    S row_nonzero{};
+                    for (std::size_t x = 0; x < region_width; ++x) {
+                        row_sum += column_sum[x];
+                        row_nonzero += column_nonzero[x];
+                        sum[static_cast<std::size_t>(region.x0) + x] += row_sum;
+                        nonzero[static_cast<std::size_t>(region.x0) + x] += row_nonzero;
+                    }
+                    for (auto x = static_cast<std::size_t>(region.x1) + 1; x < width; ++x) {
+                        sum[x] += row_sum;
+                        nonzero[x] += row_nonzero;
+                    }
+                }
+
+                sink.commit(y, previous_sum, previous_nonzero);
+                previous_sum = sum;
+                previous_nonzero = nonzero;
+            }
+        });
+    }
+
+    if (with_rotated_) {
+        // The cones of the pixel deltas are exactly what every stored cone and diagonal sum changes by.
+        const auto delta = [&](int x, int y) {
+            if (x < region.x0 || x > region.x1 || y < region.y0 || y > region.y1) {
+                return S{};
+            }
+            return deferred_.sum[static_cast<std::size_t>(y - region.y0) * region_width + static_cast<std::size_t>(x - region.x0)];
+        };
+        std::vector<S> diagonals(rotated_diagonals_.size(), S{});
+        accumulateDiagonals<S>(width_, height_, region, delta, diagonals.data());
+        accumulateCones<S>(DiagonalSums<S>{ diagonals.data(), width_, height_ }, region.y0, height_, coneRows(), delta, [&](int y, const S* row) {
+            S* target = rotated_data_.data() + static_cast<std::size_t>(y) * static_cast<std::size_t>(width_);
+            for (int x = 0; x < width_; ++x) {
+                target[x] += row[x];
+            }
+        });
+        for (std::size_t i = 0; i < diagonals.size(); ++i) {
+            rotated_diagonals_[i] += diagonals[i];
+        }
+    }
+
+    if (histogramBins() > 0) {
+        // Column-then-row accumulation again, one bin lane per counter.
+        const std::size_t bins = histogramBins();
+        std::vector<std::uint32_t> column(region_width * bins, 0);
+        std::vector<std::uint32_t>& running = histogram_running_;
+        for (int y = region.y0; y < height_; ++y) {
+            if (y <= region.y1) {
+                const std::uint32_t* staged = deferred_.histogram.data() + static_cast<std::size_t>(y - region.y0) * region_width * bins;
+                for (std::size_t i = 0; i < region_width * bins; ++i) {
+                    column[i] += staged[i];
+                }
+            }
+
+            std::fill(running.begin(), running.end(), 0U);
+            std::uint32_t* row = histogram_data_.data() + static_cast<std::size_t>(y) * static_cast<std::size_t>(width_) * bins;
+            for (auto x = static_cast<std::size_t>(region.x0); x < static_cast<std::size_t>(width_); ++x) {
+                if (x <= static_cast<std::size_t>(region.x1)) {
+                    const std::uint32_t* counts = column.data() + (x - static_cast<std::size_t>(region.x0)) * bins;
+                    for (std::size_t b = 0; b < bins; ++b) {
+                        running[b] += counts[b];
+                    }
+                }
+                for (std::size_t b = 0; b < bins; ++b) {
+                    row[x * bins + b] += running[b];
+                }
+            }
+        }
+    }
+
+    if (with_squares_) {
+        // Same column-then-row accumulation of the deltas, straight into the row-major squares table.
+        const auto width = static_cast<std::size_t>(width_);
+        std::vector<std::uint64_t> column(region_width, 0);
+        for (int y = region.y0; y < height_; ++y) {
+            if (y <= region.y1) {
+                const auto offset = static_cast<std::size_t>(y - region.y0) * region_width;
+                for (std::size_t x = 0; x < region_width; ++x) {
+                    column[x] += deferred_.squares[offset + x];
+                }
+            }
+
+            std::uint64_t* squares = squares_data_.data() + static_cast<std::size_t>(y) * width;
+            std::uint64_t running = 0;
+            for (std::size_t x = 0; x < region_width; ++x) {
+                running += column[x];
+                squares[static_cast<std::size_t>(region.x0) + x] += running;
+            }
+            for (auto x = static_cast<std::size_t>(region.x1) + 1; x < width; ++x) {
+                squares[x] += running;
+            }
+        }
+    }
+
+    deferred_ = DeferredUpdates{};
+}
+
+template <typename T, typename S>
+PixelSum<T, S>::operator bool() const noexcept
+{
+    // Tables still pending in lazy mode count as present: the first query builds them. Concurrent queries may be
+    // building them right now, so the tables are only looked at once nothing is pending; the acquire pairs with the
+    // release in ensureTables(), after which they are never written by a const member again.
+    if (lazy_.pending.load(std::memory_order_acquire) != PixelSumTables::None) {
+        return true;
+    }
+    switch (layout_) {
+    case PixelSumLayout::Fenwick:
+        return !fenwick_data_.empty();
+    case PixelSumLayout::Sparse:
+        return !sparse_offsets_.empty();
+    case PixelSumLayout::Compact:
+        return !compact_base_.empty() && !compact_sum_.empty() && !compact_nonzero_.empty();
+    case PixelSumLayout::Tiled:
+        return !tiled_data_.empty();
+    case PixelSumLayout::RowMajor:
+    default: {
+        const auto present = [this](PixelSumTables table, const std::vector<S>& data) {
+            return (tables_ & table) == PixelSumTables::None || !data.empty();
+        };
+        return mapping_ != nullptr || (present(PixelSumTables::Sum, summed_data_) && present(PixelSumTables::NonZero, nonzero_data_));
+    }
+    }
+}
+
+template <typename T, typename S>
+PixelSumInstanceStats PixelSum<T, S>::instanceStats() const noexcept
+{
+    return PixelSumInstanceStats{ ownedBytes(), live_stats_.buildNanoseconds() };
+}
+
+template <typename T, typename S>
+std::uint64_t PixelSum<T, S>::ownedBytes() const noexcept
+{
+    const auto bytes = [](const auto& table) { return table.capacity() * sizeof(table[0]); };
+    return bytes(nonzero_data_) + bytes(summed_data_) + bytes(tiled_data_) + bytes(compact_base_) + bytes(compact_sum_) +
+           bytes(compact_nonzero_) + bytes(fenwick_data_) + bytes(sparse_offsets_) + bytes(sparse_entries_) + bytes(squares_data_) + bytes(rotated_data_) +
+           bytes(rotated_diagonals_) + bytes(histogram_data_) + bytes(histogram_edges_) + bytes(histogram_bin_of_) + bytes(histogram_running_) +
+           bytes(scratch_) + bytes(deferred_.sum) + bytes(deferred_.nonzero) + bytes(deferred_.squares) +
+           bytes(deferred_.histogram);
+}
+
+template <typename T, typename S>
+bool PixelSum<T, S>::isRepresentable(int width, int height) noexcept
+{
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    // The full image sum is the largest value any window can produce; corners themselves may wrap around since
+    // d - b - c + a is exact modulo 2^N as long as the result fits.
+    const auto dimension = static_cast<std::uint64_t>(width) * static_cast<std::uint64_t>(height);
+    const auto max_pixel = static_cast<std::uint64_t>(std::numeric_limits<T>::max());
+    const auto max_sum = static_cast<std::uint64_t>(std::numeric_limits<S>::max());
+    return dimension <= max_sum / max_pixel;
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::normalizeBounds(int& x0, int& y0, int& x1, int& y1)
+{
+    if (x0 > x1) {
+        std::swap(x0, x1);
+    }
+    if (y0 > y1) {
+        std::swap(y0, y1);
+    }
+}
+
+template <typename T, typename S>
+bool PixelSum<T, S>::clampBounds(int& x0, int& y0, int& x1, int& y1) const
+{
+    if ((x0 < 0 && x1 < 0) || (x0 >= width_ && x1 >= width_) || (y0 < 0 && y1 < 0) || (y0 >= height_ && y1 >= height_)) {
+        addCounter(Counter::EmptyWindows);
+        return false;
+    }
+
+    if constexpr (pixelSumStatsEnabled()) {
+        if (x0 < 0 || y0 < 0 || x1 >= width_ || y1 >= height_) {
+            addCounter(Counter::ClampedWindows);
+        }
+    }
+
+    x0 = std::clamp(x0, 0, width_ - 1);
+    y0 = std::clamp(y0, 0, height_ - 1);
+    x1 = std::clamp(x1, 0, width_ - 1);
+    y1 = std::clamp(y1, 0, height_ - 1);
+    return true;
+}
+
+template <typename T, typename S>
+std::size_t PixelSum<T, S>::indexOf(int x, int y, int width) noexcept
+{
+    return static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x);
+}
+
+template <typename T, typename S>
+S PixelSum<T, S>::getSummedArea(Table table, int x0, int y0, int x1, int y1) const
+{
+    return withTableReader(table, [&](const auto& at) { return summedArea<S>(at, x0, y0, x1, y1); });
+}
+
+template <typename T, typename S>
+template <typename Function>
+decltype(auto) PixelSum<T, S>::withTableReader(Table table, const Function& function) const
+{
+    switch (layout_) {
+    case PixelSumLayout::Fenwick: {
+        const S* data = fenwick_data_.data() + (table == Table::Sum ? 0 : 1);
+        const auto width = static_cast<std::size_t>(width_);
+        return function([data, width](int x, int y) -> S {
+            S value{};
+            for (auto i = static_cast<std::size_t>(y) + 1; i > 0; i &= i - 1) {
+                const S* row = data + (i - 1) * width * 2;
+                for (auto j = static_cast<std::size_t>(x) + 1; j > 0; j &= j - 1) {
+                    value += row[2 * (j - 1)];
+                }
+            }
+            return value;
+        });
+    }
+    case PixelSumLayout::Sparse: {
+        S SparseEntry::*const field = table == Table::Sum ? &SparseEntry::sum : &SparseEntry::nonzero;
+        return function([this, field](int x, int y) -> S {
+            S value{};
+            for (auto i = static_cast<std::size_t>(y) + 1; i > 0; i &= i - 1) {
+                const SparseEntry* begin = sparse_entries_.data() + sparse_offsets_[i - 1];
+                const SparseEntry* past = std::upper_bound(begin, sparse_entries_.data() + sparse_offsets_[i], x,
+                                                           [](int column, const SparseEntry& entry) { return column < entry.column; });
+                value += past != begin ? past[-1].*field : S{};
+            }
+            return value;
+        });
+    }
+    case PixelSumLayout::Compact: {
+        using Geometry = BlockGeometry<CompactSum>;
+        constexpr int kSide = Geometry::kBlockSide;
+        const Geometry geometry(width_);
+        const std::size_t lane = table == Table::Sum ? 0 : 2 * kSide;
+        const auto read = [&](const auto& local) {
+            return function([&](int x, int y) -> S {
+                const std::size_t block = geometry.blockOf(x, y);
+                const S* base = compact_base_.data() + block * Geometry::kBaseEntries + lane;
+                return base[y % kSide] + base[kSide + x % kSide] +
+                       static_cast<S>(local[block * Geometry::kBlockEntries + Geometry::localOf(x, y)]);
+            });
+        };
+        return table == Table::Sum ? read(compact_sum_.data()) : read(compact_nonzero_.data());
+    }
+    case PixelSumLayout::Tiled: {
+        const TileGeometry<S> geometry(width_);
+        const S* data = tiled_data_.data() + (table == Table::Sum ? 0 : 1);
+        return function([&](int x, int y) -> S { return data[geometry.offsetOf(x, y)]; });
+    }
+    case PixelSumLayout::RowMajor:
+    default: {
+        const S* data = rowMajorTable(table);
+        return function([&](int x, int y) -> S { return data[indexOf(x, y, width_)]; });
+    }
+    }
+}
+
+template <typename T, typename S>
+template <typename Function>
+decltype(auto) PixelSum<T, S>::withCornerReader(const Function& function) const
+{
+    switch (layout_) {
+    case PixelSumLayout::Fenwick: {
+        const auto width = static_cast<std::size_t>(width_);
+        return function([this, width](int x, int y, S* corner) {
+            S sum{};
+            S nonzero{};
+            for (auto i = static_cast<std::size_t>(y) + 1; i > 0; i &= i - 1) {
+                const S* row = fenwick_data_.data() + (i - 1) * width * 2;
+                for (auto j = static_cast<std::size_t>(x) + 1; j > 0; j &= j - 1) {
+                    sum += row[2 * (j - 1)];
+                    nonzero += row[2 * (j - 1) + 1];
+                }
+            }
+            corner[0] = sum;
+            corner[1] = nonzero;
+        });
+    }
+    case PixelSumLayout::Sparse:
+        return function([this](int x, int y, S* corner) {
+            S sum{};
+            S nonzero{};
+            for (auto i = static_cast<std::size_t>(y) + 1; i > 0; i &= i - 1) {
+                const SparseEntry* begin = sparse_entries_.data() + sparse_offsets_[i - 1];
+                const SparseEntry* past = std::upper_bound(begin, sparse_entries_.data() + sparse_offsets_[i], x,
+                                                           [](int column, const SparseEntry& entry) { return column < entry.column; });
+                if (past != begin) {
+                    sum += past[-1].sum;
+                    nonzero += past[-1].nonzero;
+                }
+            }
+            corner[0] = sum;
+            corner[1] = nonzero;
+        });
+    case PixelSumLayout::Compact: {
+        using Geometry = BlockGeometry<CompactSum>;
+        const Geometry geometry(width_);
+        return function([&](int x, int y, S* corner) {
+            constexpr int kSide = Geometry::kBlockSide;
+            const std::size_t block = geometry.blockOf(x, y);
+            const std::size_t local = block * Geometry::kBlockEntries + Geometry::localOf(x, y);
+            const S* base = compact_base_.data() + block * Geometry::kBaseEntries;
+            corner[0] = base[y % kSide] + base[kSide + x % kSide] + static_cast<S>(compact_sum_[local]);
+            corner[1] = base[2 * kSide + y % kSide] + base[3 * kSide + x % kSide] + static_cast<S>(compact_nonzero_[local]);
+        });
+    }
+    case PixelSumLayout::Tiled: {
+        const TileGeometry<S> geometry(width_);
+        return function([&](int x, int y, S* corner) {
+            const S* pair = tiled_data_.data() + geometry.offsetOf(x, y);
+            corner[0] = pair[0];
+            corner[1] = pair[1];
+        });
+    }
+    case PixelSumLayout::RowMajor:
+    default:
+        return function([sum = rowMajorTable(Table::Sum), nonzero = rowMajorTable(Table::NonZero), width = width_](
+                            int x, int y, S* corner) {
+            const std::size_t index = indexOf(x, y, width);
+            corner[0] = sum[index];
+            corner[1] = nonzero[index];
+        });
+    }
+}
+
+template <typename T, typename S>
+template <typename Function>
+decltype(auto) PixelSum<T, S>::withSinkFactory(unsigned int strips, PixelSumTables tables, const Function& function)
+{
+    // Strip i borrows the i-th slice of scratch_, which only ever grows.
+    const auto reserve_scratch = [this, strips](std::size_t size) {
+        if (scratch_.size() < strips * size) {
+            scratch_.resize(strips * size);
+        }
+        return size;
+    };
+
+    switch (layout_) {
+    case PixelSumLayout::Compact: {
+        const std::size_t size = reserve_scratch(CompactSink<S, CompactSum>::scratchSize(width_));
+        return function([this, size](unsigned int strip) {
+            return CompactSink<S, CompactSum>(std::span<S>(compact_base_),
+                                              std::span<CompactSum>(compact_sum_),
+                                              std::span<std::uint16_t>(compact_nonzero_),
+                                              std::span<S>(scratch_).subspan(strip * size, size),
+                                              width_);
+        });
+    }
+    case PixelSumLayout::Tiled: {
+        const std::size_t size = reserve_scratch(TiledSink<S>::scratchSize(width_));
+        return function([this, size](unsigned int strip) {
+            return TiledSink<S>(std::span<S>(tiled_data_), std::span<S>(scratch_).subspan(strip * size, size), width_);
+        });
+    }
+    case PixelSumLayout::RowMajor:
+    case PixelSumLayout::Fenwick:
+    default: {
+        const auto table = [tables](PixelSumTables table, std::vector<S>& data) {
+            return (tables & table) != PixelSumTables::None ? std::span<S>(data) : std::span<S>{};
+        };
+        const std::size_t size = tables == PixelSumTables::All ? 0 : reserve_scratch(RowMajorSink<S>::scratchSize(width_));
+        return function([this, table, size](unsigned int strip) {
+            return RowMajorSink<S>(table(PixelSumTables::Sum, summed_data_),
+                                   table(PixelSumTables::NonZero, nonzero_data_),
+                                   std::span<S>(scratch_).subspan(strip * size, size),
+                                   width_);
+        });
+    }
+    }
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::flushDeferred() const
+{
+    if (deferred_.region.x0 <= deferred_.region.x1) {
+        // Staged updates can only exist on objects that were non-const when deferUpdate() was called.
+        const_cast<PixelSum*>(this)->flushUpdates(); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    }
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::readRow(int y, S* sum, S* nonzero) const
+{
+    const auto width = static_cast<std::size_t>(width_);
+    if (layout_ == PixelSumLayout::RowMajor) {
+        // Tables that were not requested are skipped, leaving their target rows untouched.
+        const std::size_t offset = static_cast<std::size_t>(y) * width;
+        const S* stored_sum = rowMajorTable(Table::Sum);
+        if (stored_sum != nullptr && sum != stored_sum + offset) {
+            std::copy_n(stored_sum + offset, width, sum);
+        }
+        const S* stored_nonzero = rowMajorTable(Table::NonZero);
+        if (stored_nonzero != nullptr && nonzero != stored_nonzero + offset) {
+            std::copy_n(stored_nonzero + offset, width, nonzero);
+        }
+        return;
+    }
+
+    withCornerReader([&](const auto& read_corner) {
+        S corner[2];
+        for (int x = 0; x < width_; ++x) {
+            read_corner(x, y, corner);
+            sum[x] = corner[0];
+            nonzero[x] = corner[1];
+        }
+    });
+}
+
+// Linear-time Fenwick construction: load the pixels, then push every node into its parent along x, then along y.
+template <typename T, typename S>
+void PixelSum<T, S>::buildFenwick(const PixelSumImage<T>& source)
+{
+    const auto width = static_cast<std::size_t>(width_);
+    const auto height = static_cast<std::size_t>(height_);
+    fenwick_data_.assign(2 * width * height, S{});
+
+    for (std::size_t y = 0; y < height; ++y) {
+        const T* pixels = source.row(static_cast<int>(y));
+        S* row = fenwick_data_.data() + y * width * 2;
+        for (std::size_t x = 0; x < width; ++x) {
+            row[2 * x] = static_cast<S>(pixels[x]);
+            row[2 * x + 1] = pixels[x] > T{} ? S{1} : S{0};
+        }
+    }
+
+    for (std::size_t y = 0; y < height; ++y) {
+        S* row = fenwick_data_.data() + y * width * 2;
+        for (std::size_t x = 1; x <= width; ++x) {
+            const std::size_t parent = x + (x & (~x + 1));
+            if (parent <= width) {
+                row[2 * (parent - 1)] += row[2 * (x - 1)];
+                row[2 * (parent - 1) + 1] += row[2 * (x - 1) + 1];
+            }
+        }
+    }
+
+    for (std::size_t y = 1; y <= height; ++y) {
+        const std::size_t parent = y + (y & (~y + 1));
+        if (parent <= height) {
+            const S* row = fenwick_data_.data() + (y - 1) * width * 2;
+            S* target = fenwick_data_.data() + (parent - 1) * width * 2;
+            for (std::size_t x = 0; x < 2 * width; ++x) {
+                target[x] += row[x];
+            }
+        }
+    }
+}
+
+// Node i of the row Fenwick tree covers rows [i - lowbit(i + 1) + 1, i]: its own row plus its children's rows. The
+// first pass counts the non-zero pixels of every row to size the nodes; the second fills each node with its row and
+// copies of its (lower, so already filled) children before sorting it by column. Children still hold raw pixels
+// then, so the running sums are taken in a last pass.
+template <typename T, typename S>
+void PixelSum<T, S>::buildSparse(const PixelSumImage<T>& source)
+{
+    const auto height = static_cast<std::size_t>(height_);
+    const auto lowest = [](std::size_t i) { return i & (~i + 1); };
+
+    // Counts of rows [0, i) first, then (from the top down, as a node only looks below it) node sizes, then offsets.
+    sparse_offsets_.assign(height + 1, 0);
+    for (std::size_t y = 0; y < height; ++y) {
+        const T* pixels = source.row(static_cast<int>(y));
+        sparse_offsets_[y + 1] = sparse_offsets_[y] + static_cast<std::size_t>(std::count_if(pixels, pixels + width_, [](T pixel) {
+                                     return pixel != T{};
+                                 }));
+    }
+    for (std::size_t i = height; i > 0; --i) {
+        sparse_offsets_[i] -= sparse_offsets_[i - lowest(i)];
+    }
+    for (std::size_t i = 1; i <= height; ++i) {
+        sparse_offsets_[i] += sparse_offsets_[i - 1];
+    }
+    sparse_entries_.resize(sparse_offsets_[height]);
+
+    SparseEntry* entries = sparse_entries_.data();
+    for (std::size_t i = 1; i <= height; ++i) {
+        SparseEntry* node = entries + sparse_offsets_[i - 1];
+        SparseEntry* end = node;
+        const T* pixels = source.row(static_cast<int>(i - 1));
+        for (int x = 0; x < width_; ++x) {
+            if (pixels[x] != T{}) {
+                *end++ = SparseEntry{ x, static_cast<S>(pixels[x]), S{ 1 } };
+            }
+        }
+        for (std::size_t child = i - 1; child > i - lowest(i); child &= child - 1) {
+            end = std::copy(entries + sparse_offsets_[child - 1], entries + sparse_offsets_[child], end);
+        }
+        std::sort(node, end, [](const SparseEntry& lhs, const SparseEntry& rhs) { return lhs.column < rhs.column; });
+    }
+
+    for (std::size_t i = 0; i < height; ++i) {
+        S sum{};
+        S nonzero{};
+        for (std::size_t k = sparse_offsets_[i]; k < sparse_offsets_[i + 1]; ++k) {
+            sum += entries[k].sum;
+            nonzero += entries[k].nonzero;
+            entries[k].sum = sum;
+            entries[k].nonzero = nonzero;
+        }
+    }
+}
+
+template <typename T, typename S>
+PixelSumLayout PixelSum<T, S>::autoLayout(const PixelSumImage<T>& image) noexcept
+{
+    // An invalid image is reported by rebuild().
+    if (image.data == nullptr || image.width <= 0 || image.height <= 0 || image.stride < static_cast<std::size_t>(image.width)) {
+        return PixelSumLayout::RowMajor;
+    }
+
+    constexpr int kSampleRows = 64;
+    const int rows = std::min(image.height, kSampleRows);
+    std::size_t nonzero = 0;
+    for (int i = 0; i < rows; ++i) {
+        const T* row = image.row(static_cast<int>(static_cast<long long>(i) * image.height / rows));
+        nonzero += static_cast<std::size_t>(std::count_if(row, row + image.width, [](T pixel) { return pixel != T{}; }));
+    }
+
+    // Every pixel lands in about half of the log2(H) + 1 nodes above its row.
+    const double pixels = static_cast<double>(image.width) * static_cast<double>(image.height);
+    const double density = static_cast<double>(nonzero) / (static_cast<double>(rows) * static_cast<double>(image.width));
+    const double copies = static_cast<double>(std::bit_width(static_cast<unsigned int>(image.height)) + 1) / 2.0;
+    const double sparse = density * pixels * copies * static_cast<double>(sizeof(SparseEntry)) +
+                          static_cast<double>(image.height + 1) * static_cast<double>(sizeof(std::size_t));
+    const double dense = 2.0 * static_cast<double>(sizeof(S)) * pixels;
+    return 4.0 * sparse <= dense ? PixelSumLayout::Sparse : PixelSumLayout::RowMajor;
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::save(const std::filesystem::path& path) const
+{
+    ensureTables(tables_);
+    flushDeferred();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Cannot create table file " + path.string());
+    }
+
+    TableFileHeader header{};
+    std::copy_n(kTableFileMagic, sizeof(kTableFileMagic), header.magic);
+    header.version = kTableFileVersion;
+    header.byte_order = kTableFileByteOrder;
+    header.pixel_bytes = sizeof(T);
+    header.sum_bytes = sizeof(S);
+    header.width = width_;
+    header.height = height_;
+    header.tables = static_cast<std::uint32_t>(tables_);
+
+    char padded[kTableFileHeaderSize] = {};
+    std::memcpy(padded, &header, sizeof(header));
+    file.write(padded, sizeof(padded));
+
+    const auto width = static_cast<std::size_t>(width_);
+    const auto row_bytes = static_cast<std::streamsize>(width * sizeof(S));
+    if (layout_ == PixelSumLayout::RowMajor) {
+        // Only tables that were requested are written; rowMajorTable() is null for the others.
+        for (const Table table : { Table::Sum, Table::NonZero }) {
+            if (const S* data = rowMajorTable(table); data != nullptr) {
+                file.write(reinterpret_cast<const char*>(data), row_bytes * height_);
+            }
+        }
+    } else {
+        std::vector<S> row(2 * width);
+        for (const Table table : { Table::Sum, Table::NonZero }) {
+            const S* part = row.data() + (table == Table::Sum ? 0 : width);
+            for (int y = 0; y < height_; ++y) {
+                readRow(y, row.data(), row.data() + width);
+                file.write(reinterpret_cast<const char*>(part), row_bytes);
+            }
+        }
+    }
+
+    if (!file.flush()) {
+        throw std::runtime_error("Cannot write table file " + path.string());
+    }
+}
+
+template <typename T, typename S>
+PixelSum<T, S> PixelSum<T, S>::load(const std::filesystem::path& path)
+{
+    auto mapping = std::make_shared<MappedTables>(path);
+    const MappedFile& file = mapping->file;
+
+    TableFileHeader header{};
+    if (file.size() < kTableFileHeaderSize) {
+        throw std::runtime_error("Not a PixelSum table file: " + path.string());
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (!std::equal(kTableFileMagic, kTableFileMagic + sizeof(kTableFileMagic), header.magic)) {
+        throw std::runtime_error("Not a PixelSum table file: " + path.string());
+    }
+    if (header.version != 1 && header.version != kTableFileVersion) {
+        throw std::runtime_error("Unsupported table file version");
+    }
+    if (header.byte_order != kTableFileByteOrder) {
+        throw std::runtime_error("Table file was written with a different byte order");
+    }
+    if (header.pixel_bytes != sizeof(T) || header.sum_bytes != sizeof(S)) {
+        throw std::runtime_error("Table file holds a different pixel or sum type");
+    }
+    if (!isRepresentable(header.width, header.height)) {
+        throw std::runtime_error("Dimension is out of bound");
+    }
+
+    const auto tables = header.version == 1 ? PixelSumTables::All : static_cast<PixelSumTables>(header.tables);
+    if (tables != PixelSumTables::Sum && tables != PixelSumTables::NonZero && tables != PixelSumTables::All) {
+        throw std::runtime_error("Table file holds an unknown set of tables");
+    }
+    const bool with_sum = (tables & PixelSumTables::Sum) != PixelSumTables::None;
+    const bool with_nonzero = (tables & PixelSumTables::NonZero) != PixelSumTables::None;
+
+    const std::size_t entries = static_cast<std::size_t>(header.width) * static_cast<std::size_t>(header.height);
+    const std::size_t count = (with_sum ? 1 : 0) + (with_nonzero ? 1 : 0);
+    if (file.size() != kTableFileHeaderSize + count * entries * sizeof(S)) {
+        throw std::runtime_error("Table file size does not match its dimensions");
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto* first = reinterpret_cast<const S*>(file.data() + kTableFileHeaderSize);
+    mapping->sum = with_sum ? first : nullptr;
+    mapping->nonzero = with_nonzero ? first + (with_sum ? entries : 0) : nullptr;
+
+    PixelSum pixel_sum;
+    pixel_sum.width_ = header.width;
+    pixel_sum.height_ = header.height;
+    pixel_sum.tables_ = tables;
+    pixel_sum.mapping_ = std::move(mapping);
+    return pixel_sum;
+}
+
+template <typename T, typename S>
+const S* PixelSum<T, S>::rowMajorTable(Table table) const noexcept
+{
+    if (mapping_ != nullptr) {
+        return table == Table::Sum ? mapping_->sum : mapping_->nonzero;
+    }
+    const std::vector<S>& data = table == Table::Sum ? summed_data_ : nonzero_data_;
+    return data.empty() ? nullptr : data.data();
+}
+
+// Gives the object private copies of mapped tables before they are modified.
+template <typename T, typename S>
+void PixelSum<T, S>::detachMapping()
+{
+    if (mapping_ == nullptr) {
+        return;
+    }
+
+    // A table the file does not hold stays empty, as in an object built without it.
+    const std::size_t entries = static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_);
+    const auto copy = [entries](const S* mapped, std::vector<S>& data) {
+        if (mapped != nullptr) {
+            data.assign(mapped, mapped + entries);
+        } else {
+            data.clear();
+        }
+    };
+    copy(mapping_->sum, summed_data_);
+    copy(mapping_->nonzero, nonzero_data_);
+    mapping_.reset();
+    live_stats_.track(ownedBytes());
+}
+
+template <typename T, typename S>
+PixelSumStream<T, S>::PixelSumStream(int width, int capacity)
+    : width_(width)
+    , capacity_(capacity)
+{
+    if (width <= 0 || capacity < 0 || (capacity > 0 && !PixelSum<T, S>::isRepresentable(width, capacity))) {
+        throw std::runtime_error("Dimension is out of bound");
+    }
+
+    if (capacity_ > 0) {
+        data_.resize(2 * static_cast<std::size_t>(width_) * (static_cast<std::size_t>(capacity_) + 1));
+    }
+}
+
+template <typename T, typename S>
+void PixelSumStream<T, S>::pushRow(std::span<const T> row)
+{
+    const auto width = static_cast<std::size_t>(width_);
+    if (row.size() < width) {
+        throw std::runtime_error("Row size is smaller than width");
+    }
+
+    if (capacity_ == 0) {
+        // Without a ring the whole-image sum bounds every window, as in PixelSum.
+        if (rows_ >= std::numeric_limits<int>::max() || !PixelSum<T, S>::isRepresentable(width_, static_cast<int>(rows_) + 1)) {
+            throw std::runtime_error("Dimension is out of bound");
+        }
+        data_.resize(data_.size() + 2 * width);
+    }
+
+    // Row rows_ lives in slot rows_ % (capacity + 1) of the ring, which never holds the previous row as well;
+    // wrap-around keeps the window differences exact however large the running sums get.
+    S* sum = data_.data() + offsetOf(rows_);
+    const S* previous = rows_ > 0 ? data_.data() + offsetOf(rows_ - 1) : nullptr;
+    accumulateRow<T, S>(row.data(),
+                        width_,
+                        previous,
+                        previous != nullptr ? previous + width : nullptr,
+                        sum,
+                        sum + width);
+    ++rows_;
+}
+
+template <typename T, typename S>
+std::int64_t PixelSumStream<T, S>::firstRow() const noexcept
+{
+    return capacity_ > 0 ? std::max<std::int64_t>(rows_ - capacity_, 0) : 0;
+}
+
+template <typename T, typename S>
+S PixelSumStream<T, S>::getPixelSum(int x0, std::int64_t y0, int x1, std::int64_t y1) const
+{
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
+    }
+    return getSummedArea(0, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSumStream<T, S>::getPixelAverage(int x0, std::int64_t y0, int x1, std::int64_t y1) const
+{
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    return static_cast<double>(getSummedArea(0, x0, y0, x1, y1)) / count;
+}
+
+template <typename T, typename S>
+S PixelSumStream<T, S>::getNonZeroCount(int x0, std::int64_t y0, int x1, std::int64_t y1) const
+{
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
+    }
+    return getSummedArea(static_cast<std::size_t>(width_), x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSumStream<T, S>::getNonZeroAverage(int x0, std::int64_t y0, int x1, std::int64_t y1) const
+{
+    const auto sum = static_cast<double>(getPixelSum(x0, y0, x1, y1));
+    const auto count = getNonZeroCount(x0, y0, x1, y1);
+    return count > S{} ? (sum / static_cast<double>(count)) : 0.0;
+}
+
+template <typename T, typename S>
+std::size_t PixelSumStream<T, S>::offsetOf(std::int64_t y) const noexcept
+{
+    const auto slot = capacity_ > 0 ? static_cast<std::size_t>(y % (capacity_ + 1)) : static_cast<std::size_t>(y);
+    return slot * 2 * static_cast<std::size_t>(width_);
+}
+
+template <typename T, typename S>
+bool PixelSumStream<T, S>::clampBounds(int& x0, std::int64_t& y0, int& x1, std::int64_t& y1) const
+{
+    if (x0 > x1) {
+        std::swap(x0, x1);
+    }
+    if (y0 > y1) {
+        std::swap(y0, y1);
+    }
+    if (rows_ == 0 || x1 < 0 || x0 >= width_ || y1 < 0 || y0 >= rows_) {
+        return false;
+    }
+
+    x0 = std::clamp(x0, 0, width_ - 1);
+    x1 = std::clamp(x1, 0, width_ - 1);
+    y0 = std::clamp<std::int64_t>(y0, 0, rows_ - 1);
+    y1 = std::clamp<std::int64_t>(y1, 0, rows_ - 1);
+    if (y0 < firstRow()) {
+        throw std::runtime_error("Window rows are no longer buffered");
+    }
+    return true;
+}
+
+template <typename T, typename S>
+S PixelSumStream<T, S>::getSummedArea(std::size_t offset, int x0, std::int64_t y0, int x1, std::int64_t y1) const
+{
+    const S* bottom = data_.data() + offsetOf(y1) + offset;
+    const S* top = y0 > 0 ? data_.data() + offsetOf(y0 - 1) + offset : nullptr;
+    const S d = bottom[x1];
+    const S c = x0 > 0 ? bottom[x0 - 1] : S{};
+    const S b = top != nullptr ? top[x1] : S{};
+    const S a = (top != nullptr && x0 > 0) ? top[x0 - 1] : S{};
+    return d - b - c + a;
+}
+
+template <typename T, typename S>
+void PixelSum<T, S>::configureHistogram(const PixelSumOptions& options)
+{
+    constexpr std::uint32_t kValues = static_cast<std::uint32_t>(std::numeric_limits<T>::max()) + 1;
+    if (options.histogram_bins > 0 && !options.histogram_edges.empty()) {
+        throw std::runtime_error("Histogram bins and edges cannot be combined");
+    }
+
+    histogram_edges_.clear();
+    if (options.histogram_bins > 0) {
+        if (options.histogram_bins > kValues) {
+            throw std::runtime_error("Histogram has more bins than pixel values");
+        }
+        for (std::uint32_t bin = 0; bin <= options.histogram_bins; ++bin) {
+            histogram_edges_.push_back(static_cast<std::uint32_t>(static_cast<std::uint64_t>(bin) * kValues / options.histogram_bins));
+        }
+    } else if (!options.histogram_edges.empty()) {
+        histogram_edges_.push_back(0);
+        for (const std::uint32_t edge : options.histogram_edges) {
+            if (edge <= histogram_edges_.back() || edge >= kValues) {
+                throw std::runtime_error("Histogram edges must be ascending pixel values above 0");
+            }
+            histogram_edges_.push_back(edge);
+        }
+        histogram_edges_.push_back(kValues);
+    } else {
+        return;
+    }
+
+    histogram_bin_of_.resize(kValues);
+    for (std::size_t bin = 0; bin + 1 < histogram_edges_.size(); ++bin) {
+        std::fill(histogram_bin_of_.begin() + histogram_edges_[bin],
+                  histogram_bin_of_.begin() + histogram_edges_[bin + 1],
+                  static_cast<std::uint16_t>(bin));
+    }
+    histogram_running_.assign(histogramBins(), 0U);
+}
+
+// Row recurrence of the integral histograms, one bin lane per counter: a running per-bin count of the row is added to
+// the counters of the row above.
+template <typename T, typename S>
+void PixelSum<T, S>::buildHistogram(const PixelSumImage<T>& source)
+{
+    const std::size_t bins = histogramBins();
+    const auto width = static_cast<std::size_t>(width_);
+    std::vector<std::uint32_t>& running = histogram_running_;
+
+    for (std::size_t y = 0; y < static_cast<std::size_t>(height_); ++y) {
+        std::fill(running.begin(), running.end(), 0U);
+        const T* pixels = source.row(static_cast<int>(y));
+        std::uint32_t* row = histogram_data_.data() + y * width * bins;
+        const std::uint32_t* above = y > 0 ? row - width * bins : nullptr;
+        for (std::size_t x = 0; x < width; ++x) {
+            ++running[histogram_bin_of_[static_cast<std::size_t>(pixels[x])]];
+            std::uint32_t* counts = row + x * bins;
+            if (above != nullptr) {
+                for (std::size_t b = 0; b < bins; ++b) {
+                    counts[b] = above[x * bins + b] + running[b];
+                }
+            } else {
+                std::copy_n(running.data(), bins, counts);
+            }
+        }
+    }
+}
+
+template <typename T, typename S>
+std::span<S> PixelSum<T, S>::coneRows()
+{
+    const std::size_t size = 3 * static_cast<std::size_t>(width_);
+    if (scratch_.size() < size) {
+        scratch_.resize(size);
+    }
+    return std::span<S>(scratch_).first(size);
+}
+
+template <typename T, typename S>
+std::size_t PixelSum<T, S>::histogramBins() const noexcept
+{
+    return histogram_edges_.empty() ? 0 : histogram_edges_.size() - 1;
+}
+
+namespace {
+// One row of the interleaved channel tables. Each pixel adds its values and non-zero flags onto its left
+// neighbour's entries (the row prefix sums), then the row above is added in a single contiguous sweep. With
+// kChannels fixed at compile time the per-pixel step is a short vector add; 0 reads the count from `channels`.
+template <int kChannels, typename T, typename S>
+void accumulateInterleavedRow(const T* source, int width, int channels, const S* above, S* row)
+{
+    const auto count = static_cast<std::size_t>(kChannels > 0 ? kChannels : channels);
+    const std::size_t stride = 2 * count;
+
+    for (std::size_t x = 0; x < static_cast<std::size_t>(width); ++x) {
+        const T* pixel = source + x * count;
+        const S* left = row + x * stride;
+        S* entries = row + (x + 1) * stride;
+        for (std::size_t c = 0; c < count; ++c) {
+            entries[c] = left[c] + static_cast<S>(pixel[c]);
+            entries[count + c] = left[count + c] + (pixel[c] > T{} ? S{1} : S{0});
+        }
+    }
+
+    const std::size_t entries = (static_cast<std::size_t>(width) + 1) * stride;
+    for (std::size_t i = stride; i < entries; ++i) {
+        row[i] += above[i];
+    }
+}
+} // namespace
+
+template <typename T, typename S>
+PixelSumChannels<T, S>::PixelSumChannels(const T* buffer, int width, int height, int channels)
+    : PixelSumChannels(std::span<const T>(buffer,
+                                          static_cast<std::size_t>(std::max(width, 0)) * static_cast<std::size_t>(std::max(height, 0)) *
+                                              static_cast<std::size_t>(std::max(channels, 0))),
+                       width,
+                       height,
+                       channels)
+{
+}
+
+template <typename T, typename S>
+PixelSumChannels<T, S>::PixelSumChannels(std::span<const T> buffer, int width, int height, int channels)
+    : width_(width)
+    , height_(height)
+    , channels_(channels)
+{
+    if (!PixelSum<T, S>::isRepresentable(width, height) || channels <= 0) {
+        throw std::runtime_error("Dimension is out of bound");
+    }
+
+    const auto values = static_cast<std::size_t>(width) * static_cast<std::size_t>(channels);
+    if (buffer.size() / static_cast<std::size_t>(height) < values) {
+        throw std::runtime_error("Buffer size is smaller than width*height*channels");
+    }
+
+    const std::size_t row_entries = (static_cast<std::size_t>(width_) + 1) * stride();
+    data_.assign(row_entries * (static_cast<std::size_t>(height_) + 1), S{});
+    for (std::size_t y = 0; y < static_cast<std::size_t>(height_); ++y) {
+        const T* source = buffer.data() + y * values;
+        const S* above = data_.data() + y * row_entries;
+        S* row = data_.data() + (y + 1) * row_entries;
+        switch (channels_) {
+        case 1:
+            accumulateInterleavedRow<1>(source, width_, channels_, above, row);
+            break;
+        case 2:
+            accumulateInterleavedRow<2>(source, width_, channels_, above, row);
+            break;
+        case 3:
+            accumulateInterleavedRow<3>(source, width_, channels_, above, row);
+            break;
+        case 4:
+            accumulateInterleavedRow<4>(source, width_, channels_, above, row);
+            break;
+        default:
+            accumulateInterleavedRow<0>(source, width_, channels_, above, row);
+            break;
+        }
+    }
+}
+
+template <typename T, typename S>
+S PixelSumChannels<T, S>::getPixelSum(int channel, int x0, int y0, int x1, int y1) const
+{
+    checkChannel(channel);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
+    }
+    return windowEntry(static_cast<std::size_t>(channel), x0, y0, x1, y1);
+}
 
-    for (int x = 1; x < width; ++x) {
-        target[at(x, 0)] = target[at(x - 1, 0)] + transformer(source[at(x, 0)]);
+template <typename T, typename S>
+double PixelSumChannels<T, S>::getPixelAverage(int channel, int x0, int y0, int x1, int y1) const
+{
+    checkChannel(channel);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
     }
 
-    for (int y = 1; y < height; ++y) {
-        target[at(0, y)] = target[at(0, y - 1)] + transformer(source[at(0, y)]);
-        for (int x = 1; x < width; ++x) {
-            target[at(x, y)] = transformer(source[at(x, y)]) + target[at(x, y - 1)] + target[at(x - 1, y)] -
-                               target[at(x - 1, y - 1)];
-        }
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    return static_cast<double>(windowEntry(static_cast<std::size_t>(channel), x0, y0, x1, y1)) / count;
+}
+
+template <typename T, typename S>
+S PixelSumChannels<T, S>::getNonZeroCount(int channel, int x0, int y0, int x1, int y1) const
+{
+    checkChannel(channel);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return S{};
     }
+    return windowEntry(static_cast<std::size_t>(channels_ + channel), x0, y0, x1, y1);
 }
 
 template <typename T, typename S>
-void buildIntegralImage(std::span<const T> source, int width, int height, std::span<S> target)
+double PixelSumChannels<T, S>::getNonZeroAverage(int channel, int x0, int y0, int x1, int y1) const
 {
-    buildIntegralImage<T, S>(source, width, height, target, [](const T value) -> S { return static_cast<S>(value); });
+    checkChannel(channel);
+    if (!clampBounds(x0, y0, x1, y1)) {
+        return 0.0;
+    }
+
+    const S count = windowEntry(static_cast<std::size_t>(channels_ + channel), x0, y0, x1, y1);
+    const auto sum = static_cast<double>(windowEntry(static_cast<std::size_t>(channel), x0, y0, x1, y1));
+    return count > S{} ? (sum / static_cast<double>(count)) : 0.0;
 }
-} // namespace
 
 template <typename T, typename S>
-PixelSum<T, S>::PixelSum(const T* buffer, int width, int height)
-    : PixelSum(std::span<const T>(buffer, static_cast<std::size_t>(width) * static_cast<std::size_t>(height)), width, height)
+void PixelSumChannels<T, S>::getChannelStats(int x0, int y0, int x1, int y1, std::span<PixelSumStats<S>> stats) const
 {
+    if (stats.size() < static_cast<std::size_t>(channels_)) {
+        throw std::runtime_error("Result size is smaller than the channel count");
+    }
+    if (!clampBounds(x0, y0, x1, y1)) {
+        std::fill_n(stats.begin(), channels_, PixelSumStats<S>{});
+        return;
+    }
+
+    // Each corner's entries for all channels sit side by side.
+    const std::size_t row_entries = (static_cast<std::size_t>(width_) + 1) * stride();
+    const S* top = data_.data() + static_cast<std::size_t>(y0) * row_entries;
+    const S* bottom = data_.data() + (static_cast<std::size_t>(y1) + 1) * row_entries;
+    const std::size_t left = static_cast<std::size_t>(x0) * stride();
+    const std::size_t right = (static_cast<std::size_t>(x1) + 1) * stride();
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    const auto channels = static_cast<std::size_t>(channels_);
+
+    for (std::size_t c = 0; c < channels; ++c) {
+        const S sum = bottom[right + c] - bottom[left + c] - top[right + c] + top[left + c];
+        const std::size_t n = channels + c;
+        const S nonzero = bottom[right + n] - bottom[left + n] - top[right + n] + top[left + n];
+        stats[c] = PixelSumStats<S>{ sum,
+                                     nonzero,
+                                     static_cast<double>(sum) / count,
+                                     nonzero > S{} ? static_cast<double>(sum) / static_cast<double>(nonzero) : 0.0 };
+    }
 }
 
 template <typename T, typename S>
-PixelSum<T, S>::PixelSum(std::span<const T> buffer, int width, int height)
-    : width_(width)
-    , height_(height)
+void PixelSumChannels<T, S>::checkChannel(int channel) const
 {
-    if (width_ <= 0 || width_ > kMaxWidth || height_ <= 0 || height_ > kMaxHeight) {
-        throw std::runtime_error("Dimension is out of bound");
+    if (channel < 0 || channel >= channels_) {
+        throw std::runtime_error("Channel is out of bound");
     }
+}
 
-    const auto dimension = static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_);
-    if (buffer.size() < dimension) {
-        throw std::runtime_error("Buffer size is smaller than width*height");
+template <typename T, typename S>
+bool PixelSumChannels<T, S>::clampBounds(int& x0, int& y0, int& x1, int& y1) const
+{
+    if (x0 > x1) {
+        std::swap(x0, x1);
+    }
+    if (y0 > y1) {
+        std::swap(y0, y1);
+    }
+    if (x1 < 0 || x0 >= width_ || y1 < 0 || y0 >= height_) {
+        return false;
     }
 
-    pixel_data_.assign(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(dimension));
+    x0 = std::clamp(x0, 0, width_ - 1);
+    y0 = std::clamp(y0, 0, height_ - 1);
+    x1 = std::clamp(x1, 0, width_ - 1);
+    y1 = std::clamp(y1, 0, height_ - 1);
+    return true;
+}
 
-    nonzero_data_.assign(dimension, S{});
-    buildIntegralImage<T, S>(std::span<const T>(pixel_data_),
-                             width_,
-                             height_,
-                             std::span<S>(nonzero_data_),
-                             [](const T value) -> S { return value > T{} ? S{1} : S{0}; });
+template <typename T, typename S>
+S PixelSumChannels<T, S>::windowEntry(std::size_t entry, int x0, int y0, int x1, int y1) const noexcept
+{
+    const std::size_t row_entries = (static_cast<std::size_t>(width_) + 1) * stride();
+    const S* top = data_.data() + static_cast<std::size_t>(y0) * row_entries;
+    const S* bottom = data_.data() + (static_cast<std::size_t>(y1) + 1) * row_entries;
+    const std::size_t left = static_cast<std::size_t>(x0) * stride() + entry;
+    const std::size_t right = (static_cast<std::size_t>(x1) + 1) * stride() + entry;
+    return bottom[right] - bottom[left] - top[right] + top[left];
+}
 
-    summed_data_.assign(dimension, S{});
-    buildIntegralImage<T, S>(std::span<const T>(pixel_data_), width_, height_, std::span<S>(summed_data_));
+template <typename T, typename S>
+PixelSumSnapshots<T, S>::Snapshot::Snapshot(Slot* slot, const Node* node) noexcept
+    : slot_(slot)
+    , node_(node)
+{
 }
 
 template <typename T, typename S>
-S PixelSum<T, S>::getPixelSum(int x0, int y0, int x1, int y1) const
+PixelSumSnapshots<T, S>::Snapshot::Snapshot(Snapshot&& other) noexcept
+    : slot_(std::exchange(other.slot_, nullptr))
+    , node_(std::exchange(other.node_, nullptr))
 {
-    normalizeBounds(x0, y0, x1, y1);
-    if (!clampBounds(x0, y0, x1, y1)) {
-        return S{};
+}
+
+template <typename T, typename S>
+PixelSumSnapshots<T, S>::Snapshot::~Snapshot()
+{
+    // Everything read through the snapshot happens before the writer sees the slot empty and rebuilds it.
+    if (slot_ != nullptr) {
+        slot_->pinned.store(nullptr, std::memory_order_release);
     }
+}
 
-    return getSummedArea(std::span<const S>(summed_data_), x0, y0, x1, y1);
+template <typename T, typename S>
+const PixelSum<T, S>& PixelSumSnapshots<T, S>::Snapshot::operator*() const noexcept
+{
+    return node_->pixel_sum;
 }
 
 template <typename T, typename S>
-double PixelSum<T, S>::getPixelAverage(int x0, int y0, int x1, int y1) const
+const PixelSum<T, S>* PixelSumSnapshots<T, S>::Snapshot::operator->() const noexcept
 {
-    normalizeBounds(x0, y0, x1, y1);
-    if (!clampBounds(x0, y0, x1, y1)) {
-        return 0.0;
+    return &node_->pixel_sum;
+}
+
+template <typename T, typename S>
+std::uint64_t PixelSumSnapshots<T, S>::Snapshot::version() const noexcept
+{
+    return node_->version;
+}
+
+template <typename T, typename S>
+PixelSumSnapshots<T, S>::Reader::Reader(const PixelSumSnapshots* owner, Slot* slot) noexcept
+    : owner_(owner)
+    , slot_(slot)
+{
+}
+
+template <typename T, typename S>
+PixelSumSnapshots<T, S>::Reader::Reader(Reader&& other) noexcept
+    : owner_(std::exchange(other.owner_, nullptr))
+    , slot_(std::exchange(other.slot_, nullptr))
+{
+}
+
+template <typename T, typename S>
+PixelSumSnapshots<T, S>::Reader::~Reader()
+{
+    if (slot_ != nullptr) {
+        slot_->claimed.store(false, std::memory_order_release);
     }
+}
 
-    const auto count = static_cast<double>((x1 - x0 + 1) * (y1 - y0 + 1));
-    const auto sum = static_cast<double>(getSummedArea(std::span<const S>(summed_data_), x0, y0, x1, y1));
-    return count > 0.0 ? (sum / count) : 0.0;
+template <typename T, typename S>
+typename PixelSumSnapshots<T, S>::Snapshot PixelSumSnapshots<T, S>::Reader::acquire()
+{
+    if (slot_->pinned.load(std::memory_order_relaxed) != nullptr) {
+        throw std::runtime_error("Reader already holds a snapshot");
+    }
+
+    // Sequentially consistent, like the writer's swap and slot scan: either the writer sees the slot, or the
+    // re-check sees the swap and moves on to the new snapshot.
+    const Node* node = owner_->current_.load(std::memory_order_seq_cst);
+    for (;;) {
+        slot_->pinned.store(node, std::memory_order_seq_cst);
+        const Node* current = owner_->current_.load(std::memory_order_seq_cst);
+        if (current == node) {
+            return Snapshot(slot_, node);
+        }
+        node = current;
+    }
 }
 
 template <typename T, typename S>
-S PixelSum<T, S>::getNonZeroCount(int x0, int y0, int x1, int y1) const
+PixelSumSnapshots<T, S>::PixelSumSnapshots(const PixelSumImage<T>& image, const PixelSumOptions& options)
+    : options_(options)
 {
-    normalizeBounds(x0, y0, x1, y1);
-    if (!clampBounds(x0, y0, x1, y1)) {
-        return S{};
+    if (options.lazy) {
+        throw std::runtime_error("Snapshots cannot be built lazily");
     }
 
-    return getSummedArea(std::span<const S>(nonzero_data_), x0, y0, x1, y1);
+    current_owner_ = std::make_unique<Node>(PixelSum<T, S>(image, options_), 0U);
+    current_.store(current_owner_.get(), std::memory_order_release);
 }
 
 template <typename T, typename S>
-double PixelSum<T, S>::getNonZeroAverage(int x0, int y0, int x1, int y1) const
+PixelSumSnapshots<T, S>::PixelSumSnapshots(std::span<const T> buffer, int width, int height, const PixelSumOptions& options)
+    : options_(options)
 {
-    const auto sum = static_cast<double>(getPixelSum(x0, y0, x1, y1));
-    const auto count = getNonZeroCount(x0, y0, x1, y1);
-    return count > S{} ? (sum / static_cast<double>(count)) : 0.0;
+    if (options.lazy) {
+        throw std::runtime_error("Snapshots cannot be built lazily");
+    }
+
+    current_owner_ = std::make_unique<Node>(PixelSum<T, S>(buffer, width, height, options_), 0U);
+    current_.store(current_owner_.get(), std::memory_order_release);
 }
 
 template <typename T, typename S>
-PixelSum<T, S>::operator bool() const noexcept
+PixelSumSnapshots<T, S>::~PixelSumSnapshots() = default;
+
+template <typename T, typename S>
+typename PixelSumSnapshots<T, S>::Reader PixelSumSnapshots<T, S>::reader()
 {
-    return !pixel_data_.empty() && !nonzero_data_.empty() && !summed_data_.empty();
+    const std::lock_guard lock(slots_mutex_);
+    auto free = std::find_if(slots_.begin(), slots_.end(), [](const Slot& slot) {
+        return !slot.claimed.load(std::memory_order_acquire);
+    });
+    if (free == slots_.end()) {
+        slots_.emplace_back();
+        free = std::prev(slots_.end());
+    }
+    free->claimed.store(true, std::memory_order_relaxed);
+    return Reader(this, &*free);
 }
 
 template <typename T, typename S>
-void PixelSum<T, S>::normalizeBounds(int& x0, int& y0, int& x1, int& y1)
+void PixelSumSnapshots<T, S>::publish(const PixelSumImage<T>& image)
 {
-    if (x0 > x1) {
-        std::swap(x0, x1);
+    publishFrame(image);
+}
+
+template <typename T, typename S>
+void PixelSumSnapshots<T, S>::publish(std::span<const T> buffer, int width, int height)
+{
+    publishFrame(buffer, width, height);
+}
+
+template <typename T, typename S>
+template <typename... Frame>
+void PixelSumSnapshots<T, S>::publishFrame(const Frame&... frame)
+{
+    const std::lock_guard lock(writer_mutex_);
+
+    // Recycle a retired snapshot no reader pins; a failed rebuild leaves it retired, to be rebuilt next time.
+    std::unique_ptr<Node> node;
+    const auto spare = std::find_if(retired_.begin(), retired_.end(), [this](const auto& retired) {
+        return !isPinned(retired.get());
+    });
+    if (spare != retired_.end()) {
+        (*spare)->pixel_sum.rebuild(frame...);
+        node = std::move(*spare);
+        retired_.erase(spare);
+    } else {
+        node = std::make_unique<Node>(PixelSum<T, S>(frame..., options_), 0U);
     }
-    if (y0 > y1) {
-        std::swap(y0, y1);
+    node->version = current_owner_->version + 1;
+
+    current_.store(node.get(), std::memory_order_seq_cst);
+    version_.store(node->version, std::memory_order_release);
+    retired_.push_back(std::exchange(current_owner_, std::move(node)));
+
+    // One unpinned spare is enough for the next frame; the others were left over by readers that held on.
+    bool kept_spare = false;
+    for (auto retired = retired_.begin(); retired != retired_.end();) {
+        if (isPinned(retired->get()) || !std::exchange(kept_spare, true)) {
+            ++retired;
+        } else {
+            retired = retired_.erase(retired);
+        }
     }
 }
 
 template <typename T, typename S>
-bool PixelSum<T, S>::clampBounds(int& x0, int& y0, int& x1, int& y1) const
+std::uint64_t PixelSumSnapshots<T, S>::version() const noexcept
 {
-    if ((x0 < 0 && x1 < 0) || (x0 >= width_ && x1 >= width_) || (y0 < 0 && y1 < 0) || (y0 >= height_ && y1 >= height_)) {
+    return version_.load(std::memory_order_acquire);
+}
+
+template <typename T, typename S>
+std::size_t PixelSumSnapshots<T, S>::snapshotCount() const
+{
+    const std::lock_guard lock(writer_mutex_);
+    return retired_.size() + 1;
+}
+
+template <typename T, typename S>
+bool PixelSumSnapshots<T, S>::isPinned(const Node* node) const
+{
+    const std::lock_guard lock(slots_mutex_);
+    return std::any_of(slots_.begin(), slots_.end(), [node](const Slot& slot) {
+        return slot.pinned.load(std::memory_order_seq_cst) == node;
+    });
+}
+
+template <typename T, typename S>
+PixelSumPatch<T, S>::PixelSumPatch(const S* summed, const S* nonzero, int width, int height) noexcept
+    : summed_(summed)
+    , nonzero_(nonzero)
+    , width_(width)
+    , height_(height)
+{
+}
+
+template <typename T, typename S>
+S PixelSumPatch<T, S>::getPixelSum(int x0, int y0, int x1, int y1) const noexcept
+{
+    return clampBounds(x0, y0, x1, y1) ? getPixelSumUnchecked(x0, y0, x1, y1) : S{};
+}
+
+template <typename T, typename S>
+double PixelSumPatch<T, S>::getPixelAverage(int x0, int y0, int x1, int y1) const noexcept
+{
+    return clampBounds(x0, y0, x1, y1) ? getPixelAverageUnchecked(x0, y0, x1, y1) : 0.0;
+}
+
+template <typename T, typename S>
+S PixelSumPatch<T, S>::getNonZeroCount(int x0, int y0, int x1, int y1) const noexcept
+{
+    return clampBounds(x0, y0, x1, y1) ? getNonZeroCountUnchecked(x0, y0, x1, y1) : S{};
+}
+
+template <typename T, typename S>
+double PixelSumPatch<T, S>::getNonZeroAverage(int x0, int y0, int x1, int y1) const noexcept
+{
+    return clampBounds(x0, y0, x1, y1) ? getNonZeroAverageUnchecked(x0, y0, x1, y1) : 0.0;
+}
+
+template <typename T, typename S>
+S PixelSumPatch<T, S>::getPixelSumUnchecked(int x0, int y0, int x1, int y1) const noexcept
+{
+    return windowOf(summed_, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSumPatch<T, S>::getPixelAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept
+{
+    const auto count = static_cast<double>(x1 - x0 + 1) * static_cast<double>(y1 - y0 + 1);
+    return static_cast<double>(windowOf(summed_, x0, y0, x1, y1)) / count;
+}
+
+template <typename T, typename S>
+S PixelSumPatch<T, S>::getNonZeroCountUnchecked(int x0, int y0, int x1, int y1) const noexcept
+{
+    return windowOf(nonzero_, x0, y0, x1, y1);
+}
+
+template <typename T, typename S>
+double PixelSumPatch<T, S>::getNonZeroAverageUnchecked(int x0, int y0, int x1, int y1) const noexcept
+{
+    const S nonzero = windowOf(nonzero_, x0, y0, x1, y1);
+    return nonzero > S{} ? (static_cast<double>(windowOf(summed_, x0, y0, x1, y1)) / static_cast<double>(nonzero)) : 0.0;
+}
+
+template <typename T, typename S>
+bool PixelSumPatch<T, S>::clampBounds(int& x0, int& y0, int& x1, int& y1) const noexcept
+{
+    if (x0 > x1) {
+        std::swap(x0, x1);
+    }
+    if (y0 > y1) {
+        std::swap(y0, y1);
+    }
+    if (x1 < 0 || x0 >= width_ || y1 < 0 || y0 >= height_) {
         return false;
     }
 
@@ -145,23 +3734,249 @@ bool PixelSum<T, S>::clampBounds(int& x0, int& y0, int& x1, int& y1) const
 }
 
 template <typename T, typename S>
-std::size_t PixelSum<T, S>::indexOf(int x, int y, int width) noexcept
+S PixelSumPatch<T, S>::windowOf(const S* table, int x0, int y0, int x1, int y1) const noexcept
+{
+    const auto row = static_cast<std::size_t>(width_) + 1;
+    const S* top = table + static_cast<std::size_t>(y0) * row;
+    const S* bottom = table + (static_cast<std::size_t>(y1) + 1) * row;
+    const auto left = static_cast<std::size_t>(x0);
+    const auto right = static_cast<std::size_t>(x1) + 1;
+    return bottom[right] - bottom[left] - top[right] + top[left];
+}
+
+// Threads 1 to count - 1 of a batch, parked between rebuilds; run() makes the calling thread worker 0. A rebuild
+// takes no allocation and starts no thread once these exist.
+template <typename T, typename S>
+class PixelSumBatch<T, S>::Workers {
+public:
+    explicit Workers(unsigned int count)
+        : ranges_(count)
+    {
+        threads_.reserve(count - 1);
+        for (unsigned int worker = 1; worker < count; ++worker) {
+            threads_.emplace_back([this, worker] { serve(worker); });
+        }
+    }
+
+    Workers(const Workers&) = delete;
+    Workers& operator=(const Workers&) = delete;
+
+    ~Workers()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+    }
+
+    // Calls build(i) for every i below count on the first `active` workers, and returns once all of them are done.
+    template <typename Build>
+    void run(unsigned int active, std::uint32_t count, const Build& build)
+    {
+        ranges_.reset(active, count);
+        {
+            const std::lock_guard lock(mutex_);
+            job_ = [](const void* context, std::uint32_t index) { (*static_cast<const Build*>(context))(index); };
+            context_ = &build;
+            active_ = active;
+            busy_ = static_cast<unsigned int>(threads_.size());
+            ++generation_;
+        }
+        wake_.notify_all();
+        work(0);
+
+        std::unique_lock lock(mutex_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+private:
+    void serve(unsigned int worker)
+    {
+        std::uint64_t seen = 0;
+        for (;;) {
+            bool active = false;
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stopping_ || generation_ != seen; });
+                if (stopping_) {
+                    return;
+                }
+                seen = generation_;
+                active = worker < active_;
+            }
+            if (active) {
+                work(worker);
+            }
+            {
+                const std::lock_guard lock(mutex_);
+                if (--busy_ == 0) {
+                    done_.notify_one();
+                }
+            }
+        }
+    }
+
+    void work(unsigned int worker)
+    {
+        std::uint32_t index = 0;
+        while (ranges_.next(worker, index)) {
+            job_(context_, index);
+        }
+    }
+
+    StealingRanges ranges_;
+    // The current job, written under mutex_ before generation_ moves on, so a woken worker sees it.
+    void (*job_)(const void*, std::uint32_t){ nullptr };
+    const void* context_{ nullptr };
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::uint64_t generation_{ 0 };
+    unsigned int active_{ 0 };
+    unsigned int busy_{ 0 };
+    bool stopping_{ false };
+    // Last, so the threads are joined before the state they wait on goes away.
+    std::vector<std::jthread> threads_;
+};
+
+template <typename T, typename S>
+PixelSumBatch<T, S>::PixelSumBatch(std::span<const PixelSumImage<T>> images, unsigned int thread_count)
+    : thread_count_(thread_count > 0 ? thread_count : std::max(1U, std::thread::hardware_concurrency()))
+{
+    rebuild(images);
+}
+
+template <typename T, typename S>
+PixelSumBatch<T, S>::PixelSumBatch(const PixelSumBatch& other)
+    : thread_count_(other.thread_count_)
+    , patches_(other.patches_)
+    , arena_(other.arena_)
 {
-    return static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x);
 }
 
 template <typename T, typename S>
-S PixelSum<T, S>::getSummedArea(std::span<const S> data, int x0, int y0, int x1, int y1) const
+PixelSumBatch<T, S>& PixelSumBatch<T, S>::operator=(const PixelSumBatch& other)
 {
-    const auto idx = [this](int x, int y) -> std::size_t { return indexOf(x, y, width_); };
+    if (this != &other) {
+        // The workers are kept unless the thread count changes.
+        if (thread_count_ != other.thread_count_) {
+            workers_.reset();
+        }
+        thread_count_ = other.thread_count_;
+        patches_ = other.patches_;
+        arena_ = other.arena_;
+    }
+    return *this;
+}
+
+template <typename T, typename S>
+PixelSumBatch<T, S>::PixelSumBatch(PixelSumBatch&&) noexcept = default;
 
-    const S d = data[idx(x1, y1)];
-    const S b = y0 > 0 ? data[idx(x1, y0 - 1)] : S{};
-    const S c = x0 > 0 ? data[idx(x0 - 1, y1)] : S{};
-    const S a = (x0 > 0 && y0 > 0) ? data[idx(x0 - 1, y0 - 1)] : S{};
+template <typename T, typename S>
+PixelSumBatch<T, S>& PixelSumBatch<T, S>::operator=(PixelSumBatch&&) noexcept = default;
 
-    return d - b - c + a;
+template <typename T, typename S>
+PixelSumBatch<T, S>::~PixelSumBatch() = default;
+
+template <typename T, typename S>
+void PixelSumBatch<T, S>::rebuild(std::span<const PixelSumImage<T>> images)
+{
+    if (images.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Too many images in one batch");
+    }
+
+    // Check every image before touching the arena, so a bad one leaves the batch as it was.
+    std::size_t entries = 0;
+    for (const auto& image : images) {
+        if (!PixelSum<T, S>::isRepresentable(image.width, image.height)) {
+            throw std::runtime_error("Dimension is out of bound");
+        }
+        if (image.stride < static_cast<std::size_t>(image.width)) {
+            throw std::runtime_error("Row stride is smaller than width");
+        }
+        entries += 2 * (static_cast<std::size_t>(image.width) + 1) * (static_cast<std::size_t>(image.height) + 1);
+    }
+
+    patches_.resize(images.size());
+    arena_.resize(entries);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        patches_[i] = PatchEntry{ offset, images[i].width, images[i].height };
+        offset += 2 * (static_cast<std::size_t>(images[i].width) + 1) * (static_cast<std::size_t>(images[i].height) + 1);
+    }
+
+    const auto build = [this, images](std::size_t i) {
+        const PatchEntry& patch = patches_[i];
+        const auto row = static_cast<std::size_t>(patch.width) + 1;
+        S* summed = arena_.data() + patch.offset;
+        S* nonzero = summed + row * (static_cast<std::size_t>(patch.height) + 1);
+        std::fill_n(summed, row, S{});
+        std::fill_n(nonzero, row, S{});
+        // Column 0 stays zero; the row kernel writes columns 1..width on top of the row above, starting from the
+        // zero top row.
+        for (int y = 0; y < patch.height; ++y) {
+            S* sum_row = summed + (static_cast<std::size_t>(y) + 1) * row;
+            S* nonzero_row = nonzero + (static_cast<std::size_t>(y) + 1) * row;
+            sum_row[0] = S{};
+            nonzero_row[0] = S{};
+            accumulateRow<T, S>(images[i].row(y), patch.width, sum_row - row + 1, nonzero_row - row + 1, sum_row + 1, nonzero_row + 1);
+        }
+    };
+
+    const auto count = static_cast<std::uint32_t>(images.size());
+    const unsigned int workers = std::min(thread_count_, std::max(1U, count));
+    if (workers == 1) {
+        for (std::size_t i = 0; i < images.size(); ++i) {
+            build(i);
+        }
+        return;
+    }
+
+    if (workers_ == nullptr) {
+        workers_ = std::make_unique<Workers>(thread_count_);
+    }
+    workers_->run(workers, count, build);
+}
+
+template <typename T, typename S>
+PixelSumPatch<T, S> PixelSumBatch<T, S>::operator[](std::size_t index) const noexcept
+{
+    const PatchEntry& patch = patches_[index];
+    const S* summed = arena_.data() + patch.offset;
+    return PixelSumPatch<T, S>(
+        summed, summed + (static_cast<std::size_t>(patch.width) + 1) * (static_cast<std::size_t>(patch.height) + 1), patch.width, patch.height);
+}
+
+template <typename T, typename S>
+PixelSumPatch<T, S> PixelSumBatch<T, S>::at(std::size_t index) const
+{
+    if (index >= patches_.size()) {
+        throw std::runtime_error("Patch index is out of bound");
+    }
+    return (*this)[index];
 }
 
 template class PixelSum<std::uint8_t, std::uint32_t>;
 template class PixelSum<std::uint16_t, std::uint64_t>;
+template class PixelSum<std::uint8_t, std::uint64_t>;
+
+template class PixelSumStream<std::uint8_t, std::uint32_t>;
+template class PixelSumStream<std::uint16_t, std::uint64_t>;
+template class PixelSumStream<std::uint8_t, std::uint64_t>;
+
+template class PixelSumChannels<std::uint8_t, std::uint32_t>;
+template class PixelSumChannels<std::uint16_t, std::uint64_t>;
+template class PixelSumChannels<std::uint8_t, std::uint64_t>;
+
+template class PixelSumSnapshots<std::uint8_t, std::uint32_t>;
+template class PixelSumSnapshots<std::uint16_t, std::uint64_t>;
+template class PixelSumSnapshots<std::uint8_t, std::uint64_t>;
+
+template class PixelSumPatch<std::uint8_t, std::uint32_t>;
+template class PixelSumPatch<std::uint16_t, std::uint64_t>;
+template class PixelSumPatch<std::uint8_t, std::uint64_t>;
+
+template class PixelSumBatch<std::uint8_t, std::uint32_t>;
+template class PixelSumBatch<std::uint16_t, std::uint64_t>;
+template class PixelSumBatch<std::uint8_t, std::uint64_t>;
@@ -2,6 +2,116 @@
 #include "support/test_utility.hpp"
 #include "support/time_utility.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace {
+// Heap allocations made through the global operator new, to check that rebuild() reuses its storage.
+std::atomic<std::size_t> allocation_count { 0 };
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size > 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/) noexcept
+{
+    std::free(memory);
+}
+
+namespace {
+template <typename T>
+std::vector<T> makeRandomPixels(int width, int height, unsigned int seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_int_distribution<int> value(0, std::numeric_limits<T>::max());
+    std::bernoulli_distribution zero(0.3);
+
+    std::vector<T> pixels(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
+    for (auto& pixel : pixels) {
+        pixel = zero(engine) ? T{} : static_cast<T>(value(engine));
+    }
+    return pixels;
+}
+
+std::vector<PixelSumWindow> makeRandomWindows(int width, int height, std::size_t count, unsigned int seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_int_distribution<int> x(-width / 2, width + width / 2);
+    std::uniform_int_distribution<int> y(-height / 2, height + height / 2);
+
+    std::vector<PixelSumWindow> windows(count);
+    for (auto& window : windows) {
+        window = PixelSumWindow { x(engine), y(engine), x(engine), y(engine) };
+    }
+    return windows;
+}
+
+// Compares every prefix window against a brute-force sum, which pins down each entry of both integral images.
+template <typename T, typename S>
+bool matchesReference(const PixelSum<T, S>& pixel_sum, const std::vector<T>& pixels, int width, int height)
+{
+    std::vector<S> column_sum(static_cast<std::size_t>(width), S{});
+    std::vector<S> column_nonzero(static_cast<std::size_t>(width), S{});
+
+    for (int y = 0; y < height; ++y) {
+        S sum{};
+        S nonzero{};
+        for (int x = 0; x < width; ++x) {
+            const T value = pixels[static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x)];
+            column_sum[static_cast<std::size_t>(x)] += value;
+            column_nonzero[static_cast<std::size_t>(x)] += value > T{} ? 1 : 0;
+            sum += column_sum[static_cast<std::size_t>(x)];
+            nonzero += column_nonzero[static_cast<std::size_t>(x)];
+
+            if (pixel_sum.getPixelSum(0, 0, x, y) != sum || pixel_sum.getNonZeroCount(0, 0, x, y) != nonzero) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename T, typename S>
+bool matchesGetters(const PixelSum<T, S>& pixel_sum, const std::vector<PixelSumWindow>& windows)
+{
+    std::vector<PixelSumStats<S>> results(windows.size());
+    pixel_sum.getWindowStats(windows, results);
+
+    for (std::size_t i = 0; i < windows.size(); ++i) {
+        const auto [x0, y0, x1, y1] = windows[i];
+        if (results[i].sum != pixel_sum.getPixelSum(x0, y0, x1, y1)
+            || results[i].nonzero_count != pixel_sum.getNonZeroCount(x0, y0, x1, y1)
+            || results[i].pixel_average != pixel_sum.getPixelAverage(x0, y0, x1, y1)
+            || results[i].nonzero_average != pixel_sum.getNonZeroAverage(x0, y0, x1, y1)) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
 TEST(PixelSum_CaseInProblemDescription_Test, GivenPixelsInsideWindow_WhenGetPixelAverage_ThenExpectedAverageIsReturned)
 {
     std::vector<std::uint8_t> data { 0, 4, 0, 2, 1, 0 };
@@ -89,6 +199,33 @@ TEST(PixelSum_Unit_Test, GivenPixels_WhenAssignmentContruction_ThenPixelSumIsVal
     EXPECT_TRUE(pixel_sum_assignment);
 }
 
+TEST(PixelSum_Unit_Test, GivenPixels_WhenMoveContruction_ThenOnlyTargetIsValid)
+{
+    std::uint32_t width = 10;
+    std::uint32_t height = 10;
+    std::vector<std::uint8_t> data(width * height, 128);
+
+    auto pixel_sum = PixelSumU8(data.data(), width, height);
+    auto pixel_sum_moved = PixelSumU8(std::move(pixel_sum));
+
+    EXPECT_TRUE(pixel_sum_moved);
+    EXPECT_TRUE(!pixel_sum); // NOLINT(bugprone-use-after-move)
+}
+
+TEST(PixelSum_Unit_Test, GivenReleasedBuffer_WhenCallGetters_ThenExpectedResultsAreReturned)
+{
+    int width = 10;
+    int height = 10;
+    auto data = std::make_unique<std::uint8_t[]>(static_cast<std::size_t>(width * height));
+    std::fill_n(data.get(), width * height, 3);
+
+    auto pixel_sum = PixelSumU8(data.get(), width, height);
+    data.reset();
+
+    EXPECT_EQ(pixel_sum.getPixelSum(0, 0, width - 1, height - 1), 300);
+    EXPECT_EQ(pixel_sum.getNonZeroCount(2, 2, 4, 4), 9);
+}
+
 TEST(PixelSum_BoundCheck_Test, GivenZeroPixel_WhenContruction_ThenRuntimeErrorIsThrown)
 {
     std::uint32_t width = 0;
@@ -116,6 +253,36 @@ TEST(PixelSum_BoundCheck_Test, GivenInvalidPixels_WhenContruction_ThenRuntimeErr
     EXPECT_THROW(PixelSumU8(data.data(), width, height), std::runtime_error);
 }
 
+TEST(PixelSum_BoundCheck_Test, GivenWideStrip_WhenContruction_ThenNoErrorIsThrown)
+{
+    std::uint32_t width = 65536;
+    std::uint32_t height = 4;
+    std::vector<std::uint8_t> data(width * height, 255);
+
+    EXPECT_NO_THROW(PixelSumU8(data.data(), width, height));
+    EXPECT_EQ(PixelSumU8(data.data(), width, height).getPixelSum(0, 0, width - 1, height - 1), 255 * width * height);
+}
+
+TEST(PixelSum_BoundCheck_Test, GivenOverflowingDimensions_WhenIsRepresentable_ThenWideAccumulatorIsRequired)
+{
+    EXPECT_TRUE(PixelSumU8::isRepresentable(4096, 4096));
+    EXPECT_TRUE(!PixelSumU8::isRepresentable(65536, 258));
+    EXPECT_TRUE(PixelSumU8Wide::isRepresentable(65536, 65536));
+    EXPECT_TRUE(PixelSumU16::isRepresentable(65536, 65536));
+    EXPECT_TRUE(!PixelSumU8::isRepresentable(0, 1));
+}
+
+TEST(PixelSum_Build_Test, GivenRandomU8Pixels_WhenWideContruction_ThenIntegralImagesMatchReference)
+{
+    for (const auto [width, height] : { std::pair { 1, 1 }, std::pair { 7, 3 }, std::pair { 37, 23 }, std::pair { 128, 5 } }) {
+        const auto data = makeRandomPixels<std::uint8_t>(width, height, 41U);
+
+        auto pixel_sum = PixelSumU8Wide(data.data(), width, height);
+
+        EXPECT_TRUE(matchesReference(pixel_sum, data, width, height));
+    }
+}
+
 TEST(PixelSum_Smoke_Test, GivenOnePixel_WhenCallAllGetters_ThenExpectedResultsAreReturned)
 {
     std::uint32_t width = 1;
@@ -216,6 +383,1405 @@ TEST(PixelSum_SearchWindow_Test, GivenPixels_WhenGetNonZeroCountWithSearchWindow
     }
 }
 
+TEST(PixelSum_Build_Test, GivenRandomU8Pixels_WhenContruction_ThenIntegralImagesMatchReference)
+{
+    for (const auto [width, height] : { std::pair { 1, 1 }, std::pair { 7, 3 }, std::pair { 37, 23 }, std::pair { 128, 5 } }) {
+        const auto data = makeRandomPixels<std::uint8_t>(width, height, 7U);
+
+        auto pixel_sum = PixelSumU8(data.data(), width, height);
+
+        EXPECT_TRUE(matchesReference(pixel_sum, data, width, height));
+    }
+}
+
+TEST(PixelSum_Build_Test, GivenRandomU16Pixels_WhenContruction_ThenIntegralImagesMatchReference)
+{
+    for (const auto [width, height] : { std::pair { 1, 1 }, std::pair { 7, 3 }, std::pair { 37, 23 }, std::pair { 128, 5 } }) {
+        const auto data = makeRandomPixels<std::uint16_t>(width, height, 11U);
+
+        auto pixel_sum = PixelSumU16(data.data(), width, height);
+
+        EXPECT_TRUE(matchesReference(pixel_sum, data, width, height));
+    }
+}
+
+TEST(PixelSum_Build_Test, GivenRandomPixels_WhenParallelContruction_ThenIntegralImagesMatchReference)
+{
+    const int width = 301;
+    const int height = 517;
+    const auto data_u8 = makeRandomPixels<std::uint8_t>(width, height, 13U);
+    const auto data_u16 = makeRandomPixels<std::uint16_t>(width, height, 17U);
+
+    for (const unsigned int thread_count : { 0U, 2U, 3U, 8U, 64U }) {
+        auto pixel_sum_u8 = PixelSumU8(data_u8.data(), width, height, PixelSumOptions { .thread_count = thread_count });
+        auto pixel_sum_u16 = PixelSumU16(data_u16.data(), width, height, PixelSumOptions { .thread_count = thread_count });
+
+        EXPECT_TRUE(matchesReference(pixel_sum_u8, data_u8, width, height));
+        EXPECT_TRUE(matchesReference(pixel_sum_u16, data_u16, width, height));
+    }
+}
+
+TEST(PixelSum_Batch_Test, GivenRandomWindows_WhenGetWindowStats_ThenPerCallResultsAreReturned)
+{
+    const int width = 97;
+    const int height = 61;
+    const auto windows = makeRandomWindows(width, height, 1001, 23U);
+
+    const auto data_u8 = makeRandomPixels<std::uint8_t>(width, height, 19U);
+    const auto data_u16 = makeRandomPixels<std::uint16_t>(width, height, 19U);
+
+    EXPECT_TRUE(matchesGetters(PixelSumU8(data_u8.data(), width, height), windows));
+    EXPECT_TRUE(matchesGetters(PixelSumU16(data_u16.data(), width, height), windows));
+}
+
+TEST(PixelSum_Batch_Test, GivenTooSmallResults_WhenGetWindowStats_ThenRuntimeErrorIsThrown)
+{
+    std::vector<std::uint8_t> data(16, 1);
+    auto pixel_sum = PixelSumU8(data.data(), 4, 4);
+    std::vector<PixelSumWindow> windows(2);
+    std::vector<PixelSumStats<std::uint32_t>> results(1);
+
+    EXPECT_THROW(pixel_sum.getWindowStats(windows, results), std::runtime_error);
+}
+
+TEST(PixelSum_Layout_Test, GivenRandomPixels_WhenLayoutContruction_ThenRowMajorResultsAreReturned)
+{
+    const int width = 83;
+    const int height = 211;
+    const auto windows = makeRandomWindows(width, height, 1001, 29U);
+    const auto data_u8 = makeRandomPixels<std::uint8_t>(width, height, 31U);
+    const auto data_u16 = makeRandomPixels<std::uint16_t>(width, height, 37U);
+
+    for (const auto layout : { PixelSumLayout::Tiled, PixelSumLayout::Compact }) {
+        for (const unsigned int thread_count : { 1U, 3U }) {
+            const PixelSumOptions options { .thread_count = thread_count, .layout = layout };
+            auto pixel_sum_u8 = PixelSumU8(data_u8.data(), width, height, options);
+            auto pixel_sum_u16 = PixelSumU16(data_u16.data(), width, height, options);
+
+            EXPECT_TRUE(pixel_sum_u8);
+            EXPECT_TRUE(matchesReference(pixel_sum_u8, data_u8, width, height));
+            EXPECT_TRUE(matchesReference(pixel_sum_u16, data_u16, width, height));
+            EXPECT_TRUE(matchesGetters(pixel_sum_u8, windows));
+            EXPECT_TRUE(matchesGetters(pixel_sum_u16, windows));
+        }
+    }
+}
+
+TEST(PixelSum_Layout_Test, GivenSaturatedPixels_WhenCompactContruction_ThenBlockSumsDoNotOverflow)
+{
+    const int width = 48;
+    const int height = 40;
+    const std::vector<std::uint8_t> data_u8(static_cast<std::size_t>(width * height), 255);
+    const std::vector<std::uint16_t> data_u16(static_cast<std::size_t>(width * height), 65535);
+    const PixelSumOptions options { .layout = PixelSumLayout::Compact };
+
+    EXPECT_TRUE(matchesReference(PixelSumU8(data_u8.data(), width, height, options), data_u8, width, height));
+    EXPECT_TRUE(matchesReference(PixelSumU16(data_u16.data(), width, height, options), data_u16, width, height));
+}
+
+TEST(PixelSum_Layout_Test, GivenLargeImage_WhenCompactContruction_ThenTablesTakeLessMemory)
+{
+    const int width = 1024;
+    const int height = 1024;
+    const auto data_u8 = makeRandomPixels<std::uint8_t>(width, height, 241U);
+    const auto data_u16 = makeRandomPixels<std::uint16_t>(width, height, 251U);
+    const PixelSumOptions options { .layout = PixelSumLayout::Compact };
+
+    // 8-bit pixels: 2 + 2 bytes of locals and 1 byte of bases per pixel against 8 bytes, i.e. 1.6x less.
+    const auto row_major_u8 = PixelSumU8(data_u8.data(), width, height).instanceStats().bytes;
+    const auto compact_u8 = PixelSumU8(data_u8.data(), width, height, options).instanceStats().bytes;
+    EXPECT_TRUE(compact_u8 * 100 <= row_major_u8 * 63);
+
+    // 16-bit pixels: 4 + 2 bytes of locals and 1 byte of bases per pixel against 16 bytes, i.e. 2.3x less.
+    const auto row_major = PixelSumU16(data_u16.data(), width, height);
+    auto compact = PixelSumU16(data_u16.data(), width, height, options);
+    EXPECT_TRUE(compact.instanceStats().bytes * 9 <= row_major.instanceStats().bytes * 4);
+    EXPECT_TRUE(matchesReference(compact, data_u16, width, height));
+
+    // Updates patch whole 32-row block bands.
+    auto updated = row_major;
+    const std::vector<std::uint16_t> patch(40 * 30, 65535);
+    compact.update(500, 70, 539, 99, patch);
+    updated.update(500, 70, 539, 99, patch);
+    bool all_match = true;
+    for (const auto& [x0, y0, x1, y1] : makeRandomWindows(width, height, 501, 257U)) {
+        all_match = all_match && compact.getPixelSum(x0, y0, x1, y1) == updated.getPixelSum(x0, y0, x1, y1)
+            && compact.getNonZeroCount(x0, y0, x1, y1) == updated.getNonZeroCount(x0, y0, x1, y1);
+    }
+    EXPECT_TRUE(all_match);
+}
+
+TEST(PixelSum_Update_Test, GivenRandomPatches_WhenUpdate_ThenFreshBuildResultsAreReturned)
+{
+    const int width = 70;
+    const int height = 53;
+    const auto windows = makeRandomWindows(width, height, 501, 43U);
+    auto data = makeRandomPixels<std::uint8_t>(width, height, 47U);
+
+    struct Patch {
+        PixelSumWindow window;
+        std::vector<std::uint8_t> pixels;
+    };
+    std::vector<Patch> patches;
+    for (const auto& window : { PixelSumWindow { 3, 4, 20, 9 }, PixelSumWindow { 69, 52, 60, 30 }, PixelSumWindow { 0, 0, 0, 0 },
+             PixelSumWindow { 10, 5, 40, 40 } }) {
+        const int patch_width = std::abs(window.x1 - window.x0) + 1;
+        const int patch_height = std::abs(window.y1 - window.y0) + 1;
+        patches.push_back({ window, makeRandomPixels<std::uint8_t>(patch_width, patch_height, 53U + patches.size()) });
+    }
+
+    for (const auto& [window, pixels] : patches) {
+        const int x0 = std::min(window.x0, window.x1);
+        const int y0 = std::min(window.y0, window.y1);
+        const int patch_width = std::abs(window.x1 - window.x0) + 1;
+        for (std::size_t i = 0; i < pixels.size(); ++i) {
+            const auto x = static_cast<std::size_t>(x0) + i % static_cast<std::size_t>(patch_width);
+            const auto y = static_cast<std::size_t>(y0) + i / static_cast<std::size_t>(patch_width);
+            data[y * width + x] = pixels[i];
+        }
+    }
+    const auto fresh = PixelSumU8(data.data(), width, height);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick }) {
+        const auto original = makeRandomPixels<std::uint8_t>(width, height, 47U);
+        auto immediate = PixelSumU8(original.data(), width, height, PixelSumOptions { .layout = layout });
+        auto deferred = immediate;
+
+        for (const auto& [window, pixels] : patches) {
+            immediate.update(window.x0, window.y0, window.x1, window.y1, pixels);
+            deferred.deferUpdate(window.x0, window.y0, window.x1, window.y1, pixels);
+        }
+
+        EXPECT_TRUE(matchesReference(immediate, data, width, height));
+        EXPECT_TRUE(matchesReference(deferred, data, width, height));
+        EXPECT_TRUE(matchesGetters(deferred, windows));
+
+        bool all_match = true;
+        for (const auto& [x0, y0, x1, y1] : windows) {
+            all_match = all_match && immediate.getPixelSum(x0, y0, x1, y1) == fresh.getPixelSum(x0, y0, x1, y1);
+        }
+        EXPECT_TRUE(all_match);
+    }
+}
+
+TEST(PixelSum_Update_Test, GivenOutOfBoundWindow_WhenUpdate_ThenRuntimeErrorIsThrown)
+{
+    std::vector<std::uint8_t> data(16, 1);
+    auto pixel_sum = PixelSumU8(data.data(), 4, 4);
+    std::vector<std::uint8_t> pixels(4, 2);
+
+    EXPECT_THROW(pixel_sum.update(3, 3, 4, 4, pixels), std::runtime_error);
+    EXPECT_THROW(pixel_sum.update(0, 0, 2, 2, pixels), std::runtime_error);
+}
+
+TEST(PixelSum_Layout_Test, GivenRandomPixels_WhenFenwickContruction_ThenRowMajorResultsAreReturned)
+{
+    const int width = 83;
+    const int height = 67;
+    const auto windows = makeRandomWindows(width, height, 1001, 59U);
+    const auto data = makeRandomPixels<std::uint16_t>(width, height, 61U);
+    auto pixel_sum = PixelSumU16(data.data(), width, height, PixelSumOptions { .layout = PixelSumLayout::Fenwick });
+
+    EXPECT_TRUE(pixel_sum);
+    EXPECT_TRUE(matchesReference(pixel_sum, data, width, height));
+    EXPECT_TRUE(matchesGetters(pixel_sum, windows));
+}
+
+TEST(PixelSum_Layout_Test, GivenSparseMask_WhenSparseContruction_ThenRowMajorResultsAreReturned)
+{
+    const int width = 211;
+    const int height = 173;
+    const auto windows = makeRandomWindows(width, height, 1001, 239U);
+    // About 0.5% non-zero pixels, with a few runs sharing rows and columns.
+    std::vector<std::uint16_t> mask(static_cast<std::size_t>(width) * height);
+    std::mt19937 engine(241U);
+    std::uniform_int_distribution<std::size_t> index(0, mask.size() - 1);
+    for (int i = 0; i < 150; ++i) {
+        mask[index(engine)] = static_cast<std::uint16_t>(1 + i * 431);
+    }
+    std::fill_n(mask.begin() + 40 * width + 10, 30, std::uint16_t { 65535 });
+
+    const auto sparse = PixelSumU16(mask.data(), width, height, PixelSumOptions { .layout = PixelSumLayout::Sparse });
+    const auto dense = PixelSumU16(mask.data(), width, height);
+    EXPECT_TRUE(sparse);
+    EXPECT_TRUE(matchesReference(sparse, mask, width, height));
+    EXPECT_TRUE(matchesGetters(sparse, windows));
+    EXPECT_TRUE(sparse.instanceStats().bytes * 20 < dense.instanceStats().bytes);
+
+    // Auto picks Sparse for the mask only; the empty image is the degenerate case.
+    const auto noise = makeRandomPixels<std::uint16_t>(width, height, 251U);
+    const std::vector<std::uint16_t> empty(mask.size());
+    const PixelSumOptions automatic { .layout = PixelSumLayout::Auto };
+    auto chosen = PixelSumU16(mask.data(), width, height, automatic);
+    EXPECT_EQ(chosen.instanceStats().bytes, sparse.instanceStats().bytes);
+    EXPECT_EQ(PixelSumU16(noise.data(), width, height, automatic).instanceStats().bytes, dense.instanceStats().bytes);
+    const auto blank = PixelSumU16(empty.data(), width, height, automatic);
+    EXPECT_EQ(blank.getPixelSum(0, 0, width - 1, height - 1), 0U);
+    EXPECT_EQ(blank.getNonZeroCount(3, 5, 100, 90), 0U);
+
+    const std::vector<std::uint16_t> patch(4, 1);
+    EXPECT_THROW(chosen.update(0, 0, 1, 1, patch), std::runtime_error);
+
+    // rebuild() keeps the layout Auto chose, even for dense pixels.
+    chosen.rebuild(noise);
+    EXPECT_TRUE(matchesReference(chosen, noise, width, height));
+}
+
+TEST(PixelSum_Rebuild_Test, GivenNewFrames_WhenRebuild_ThenFreshBuildResultsAreReturned)
+{
+    const int width = 97;
+    const int height = 141;
+    const auto first = makeRandomPixels<std::uint8_t>(width, height, 67U);
+    const auto second = makeRandomPixels<std::uint8_t>(width, height, 71U);
+    const auto larger = makeRandomPixels<std::uint8_t>(width + 30, height + 20, 73U);
+    const auto smaller = makeRandomPixels<std::uint8_t>(width - 40, height - 60, 79U);
+    std::vector<std::uint8_t> patch(4, 9);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick }) {
+        for (const unsigned int thread_count : { 1U, 3U }) {
+            const auto options = PixelSumOptions { .thread_count = thread_count, .layout = layout };
+            auto pixel_sum = PixelSumU8(first.data(), width, height, options);
+            pixel_sum.deferUpdate(0, 0, 1, 1, patch);
+
+            pixel_sum.rebuild(second);
+            EXPECT_TRUE(matchesReference(pixel_sum, second, width, height));
+
+            pixel_sum.rebuild(larger, width + 30, height + 20);
+            EXPECT_TRUE(matchesReference(pixel_sum, larger, width + 30, height + 20));
+
+            pixel_sum.rebuild(smaller, width - 40, height - 60);
+            EXPECT_TRUE(matchesReference(pixel_sum, smaller, width - 40, height - 60));
+            EXPECT_EQ(pixel_sum.getPixelSum(0, 0, width, height), pixel_sum.getPixelSum(0, 0, width - 41, height - 61));
+        }
+    }
+}
+
+TEST(PixelSum_Rebuild_Test, GivenSameDimensions_WhenRebuild_ThenNothingIsAllocated)
+{
+    const int width = 211;
+    const int height = 157;
+    const auto first = makeRandomPixels<std::uint8_t>(width, height, 83U);
+    const auto second = makeRandomPixels<std::uint8_t>(width, height, 89U);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick }) {
+        auto front = PixelSumU8(first.data(), width, height, PixelSumOptions { .layout = layout });
+        auto back = front;
+
+        const auto before = allocation_count.load();
+        back.rebuild(second);
+        std::swap(front, back);
+        back.rebuild(first);
+        EXPECT_EQ(allocation_count.load(), before);
+
+        EXPECT_TRUE(matchesReference(front, second, width, height));
+        EXPECT_TRUE(matchesReference(back, first, width, height));
+    }
+
+    // The optional tables are rebuilt in place as well.
+    for (const auto& options : { PixelSumOptions { .with_rotated = true }, PixelSumOptions { .histogram_bins = 16 } }) {
+        auto pixel_sum = PixelSumU8(first.data(), width, height, options);
+        const auto expected = PixelSumU8(second.data(), width, height, options);
+
+        const auto before = allocation_count.load();
+        pixel_sum.rebuild(second);
+        EXPECT_EQ(allocation_count.load(), before);
+
+        EXPECT_TRUE(matchesReference(pixel_sum, second, width, height));
+        if (options.with_rotated) {
+            EXPECT_EQ(pixel_sum.getRotatedSum(100, 3, 40, 25), expected.getRotatedSum(100, 3, 40, 25));
+        } else {
+            EXPECT_EQ(pixel_sum.getPercentile(10, 20, 150, 120, 50.0), expected.getPercentile(10, 20, 150, 120, 50.0));
+        }
+    }
+}
+
+TEST(PixelSum_Rebuild_Test, GivenTooSmallBuffer_WhenRebuild_ThenRuntimeErrorIsThrown)
+{
+    std::vector<std::uint8_t> data(16, 1);
+    auto pixel_sum = PixelSumU8(data.data(), 4, 4);
+    std::vector<std::uint8_t> frame(15, 2);
+
+    EXPECT_THROW(pixel_sum.rebuild(frame), std::runtime_error);
+    EXPECT_THROW(pixel_sum.rebuild(frame, 0, 4), std::runtime_error);
+    EXPECT_EQ(pixel_sum.getPixelSum(0, 0, 3, 3), 16U);
+}
+
+TEST(PixelSum_BoxFilter_Test, GivenRadius_WhenBoxFilter_ThenPerCallResultsAreReturned)
+{
+    const int width = 77;
+    const int height = 53;
+    const auto data = makeRandomPixels<std::uint16_t>(width, height, 97U);
+    const auto size = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+    std::vector<double> averages(size);
+    std::vector<double> nonzero_averages(size);
+    std::vector<std::uint64_t> sums(size);
+    std::vector<std::uint64_t> counts(size);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        for (const unsigned int thread_count : { 1U, 3U }) {
+            const auto pixel_sum =
+                PixelSumU16(data.data(), width, height, PixelSumOptions { .thread_count = thread_count, .layout = layout });
+
+            for (const int radius : { 0, 1, 7, 30, 1000 }) {
+                pixel_sum.boxFilter(radius, PixelSumStatistic::Average, averages);
+                pixel_sum.boxFilter(radius, PixelSumStatistic::NonZeroAverage, nonzero_averages);
+                pixel_sum.boxFilter(radius, PixelSumStatistic::Sum, sums);
+                pixel_sum.boxFilter(radius, PixelSumStatistic::NonZeroCount, counts);
+
+                bool all_match = true;
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        const std::size_t i = static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x);
+                        const int x0 = x - radius;
+                        const int y0 = y - radius;
+                        const int x1 = x + radius;
+                        const int y1 = y + radius;
+                        all_match = all_match && averages[i] == pixel_sum.getPixelAverage(x0, y0, x1, y1)
+                            && nonzero_averages[i] == pixel_sum.getNonZeroAverage(x0, y0, x1, y1)
+                            && sums[i] == pixel_sum.getPixelSum(x0, y0, x1, y1)
+                            && counts[i] == pixel_sum.getNonZeroCount(x0, y0, x1, y1);
+                    }
+                }
+                EXPECT_TRUE(all_match);
+            }
+        }
+    }
+}
+
+TEST(PixelSum_BoxFilter_Test, GivenInvalidArguments_WhenBoxFilter_ThenRuntimeErrorIsThrown)
+{
+    std::vector<std::uint8_t> data(16, 1);
+    const auto pixel_sum = PixelSumU8(data.data(), 4, 4);
+    std::vector<double> averages(16);
+    std::vector<std::uint32_t> sums(16);
+
+    EXPECT_THROW(pixel_sum.boxFilter(-1, PixelSumStatistic::Average, averages), std::runtime_error);
+    EXPECT_THROW(pixel_sum.boxFilter(1, PixelSumStatistic::Average, std::span<double>(averages).first(15)), std::runtime_error);
+    EXPECT_THROW(pixel_sum.boxFilter(1, PixelSumStatistic::Average, sums), std::runtime_error);
+    EXPECT_NO_THROW(pixel_sum.boxFilter(1, PixelSumStatistic::Sum, sums));
+    EXPECT_EQ(sums[0], 4U);
+    EXPECT_EQ(sums[5], 9U);
+
+    // Later single-threaded filters reuse this thread's row buffers.
+    const auto allocations = allocation_count.load();
+    pixel_sum.boxFilter(2, PixelSumStatistic::Average, averages);
+    pixel_sum.boxFilter(1, PixelSumStatistic::Sum, sums);
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+    EXPECT_EQ(averages[0], 1.0);
+}
+
+TEST(PixelSum_Grid_Test, GivenCellsAndLevels_WhenGridFilter_ThenPerCellResultsAreReturned)
+{
+    const int width = 150;
+    const int height = 101;
+    auto data = makeRandomPixels<std::uint8_t>(width, height, 257U);
+    std::fill_n(data.begin(), 3 * width, std::uint8_t { 0 });
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        const auto pixel_sum = PixelSumU8(data.data(), width, height, PixelSumOptions { .layout = layout });
+        for (const auto& [cell_width, cell_height, levels] : { std::array { 16, 16, 4 }, std::array { 7, 3, 3 }, std::array { 200, 1, 2 } }) {
+            const std::size_t size = pixel_sum.gridSize(cell_width, cell_height, levels);
+            std::vector<double> sums(size);
+            std::vector<double> counts(size);
+            std::vector<double> averages(size);
+            std::vector<double> nonzero_averages(size);
+            std::vector<std::uint32_t> exact_sums(size);
+            pixel_sum.gridFilter(cell_width, cell_height, PixelSumStatistic::Sum, sums, levels);
+            pixel_sum.gridFilter(cell_width, cell_height, PixelSumStatistic::NonZeroCount, counts, levels);
+            pixel_sum.gridFilter(cell_width, cell_height, PixelSumStatistic::Average, averages, levels);
+            pixel_sum.gridFilter(cell_width, cell_height, PixelSumStatistic::NonZeroAverage, nonzero_averages, levels);
+            pixel_sum.gridFilter(cell_width, cell_height, PixelSumStatistic::Sum, exact_sums, levels);
+
+            // Edge cells hang over the image and are clamped by the getters.
+            std::size_t index = 0;
+            bool all_match = true;
+            for (int level = 0; level < levels; ++level) {
+                const int cell_columns = std::min(cell_width << level, width);
+                const int cell_rows = std::min(cell_height << level, height);
+                for (int y = 0; y < height; y += cell_rows) {
+                    for (int x = 0; x < width; x += cell_columns, ++index) {
+                        const int x1 = x + cell_columns - 1;
+                        const int y1 = y + cell_rows - 1;
+                        all_match = all_match && sums[index] == pixel_sum.getPixelSum(x, y, x1, y1)
+                            && exact_sums[index] == pixel_sum.getPixelSum(x, y, x1, y1)
+                            && counts[index] == pixel_sum.getNonZeroCount(x, y, x1, y1)
+                            && averages[index] == pixel_sum.getPixelAverage(x, y, x1, y1)
+                            && nonzero_averages[index] == pixel_sum.getNonZeroAverage(x, y, x1, y1);
+                    }
+                }
+            }
+            EXPECT_EQ(index, size);
+            EXPECT_TRUE(all_match);
+        }
+    }
+}
+
+TEST(PixelSum_Grid_Test, GivenInvalidArguments_WhenGridFilter_ThenRuntimeErrorIsThrown)
+{
+    const std::vector<std::uint16_t> data(40 * 30, 2);
+    const auto pixel_sum = PixelSumU16(data.data(), 40, 30, PixelSumOptions { .tables = PixelSumTables::Sum });
+    std::vector<double> output(pixel_sum.gridSize(8, 8, 2));
+    std::vector<std::uint64_t> exact(output.size());
+    EXPECT_EQ(output.size(), 5U * 4U + 3U * 2U);
+
+    // Only the sum table is read for sums and averages, and nothing is allocated.
+    const auto allocations = allocation_count.load();
+    pixel_sum.gridFilter(8, 8, PixelSumStatistic::Average, output, 2);
+    pixel_sum.gridFilter(8, 8, PixelSumStatistic::Sum, exact, 2);
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+    EXPECT_EQ(output.back(), 2.0);
+    EXPECT_EQ(exact.back(), 2U * 8U * 14U);
+
+    EXPECT_THROW(static_cast<void>(pixel_sum.gridSize(0, 8)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(pixel_sum.gridSize(8, 8, 0)), std::runtime_error);
+    EXPECT_THROW(pixel_sum.gridFilter(8, 8, PixelSumStatistic::Sum, std::span(output).first(output.size() - 1), 2), std::runtime_error);
+    EXPECT_THROW(pixel_sum.gridFilter(8, 8, PixelSumStatistic::Average, exact, 2), std::runtime_error);
+    EXPECT_THROW(pixel_sum.gridFilter(8, 8, PixelSumStatistic::NonZeroCount, output, 2), std::runtime_error);
+}
+
+TEST(PixelSum_File_Test, GivenSavedTables_WhenLoad_ThenSavedResultsAreReturned)
+{
+    const int width = 91;
+    const int height = 58;
+    const auto path = std::filesystem::temp_directory_path() / "pixel_sum_file_test.sat";
+    const auto windows = makeRandomWindows(width, height, 1001, 101U);
+    const auto data = makeRandomPixels<std::uint8_t>(width, height, 103U);
+    std::vector<std::uint8_t> patch(6, 200);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        const auto saved = PixelSumU8(data.data(), width, height, PixelSumOptions { .layout = layout });
+        saved.save(path);
+
+        auto loaded = PixelSumU8::load(path);
+        EXPECT_TRUE(loaded);
+        EXPECT_TRUE(matchesReference(loaded, data, width, height));
+        EXPECT_TRUE(matchesGetters(loaded, windows));
+
+        // Updating a loaded object must leave the file untouched.
+        auto copy = loaded;
+        loaded.update(4, 5, 6, 6, patch);
+        EXPECT_EQ(loaded.getPixelSum(4, 5, 6, 6), 1200U);
+        EXPECT_EQ(copy.getPixelSum(0, 0, width, height), saved.getPixelSum(0, 0, width, height));
+        EXPECT_TRUE(matchesReference(PixelSumU8::load(path), data, width, height));
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST(PixelSum_File_Test, GivenPartialTables_WhenSaveAndLoad_ThenOnlySavedTablesAreMapped)
+{
+    const int width = 47;
+    const int height = 31;
+    const auto path = std::filesystem::temp_directory_path() / "pixel_sum_partial_test.sat";
+    const auto data = makeRandomPixels<std::uint8_t>(width, height, 239U);
+    const auto full = PixelSumU8(data.data(), width, height);
+    const auto entries = static_cast<std::uintmax_t>(width) * static_cast<std::uintmax_t>(height);
+
+    // A lazy object builds its tables before they are written.
+    PixelSumU8(data.data(), width, height, PixelSumOptions { .tables = PixelSumTables::Sum, .lazy = true }).save(path);
+    EXPECT_EQ(std::filesystem::file_size(path), 64U + entries * sizeof(std::uint32_t));
+    auto sum_only = PixelSumU8::load(path);
+    EXPECT_TRUE(sum_only);
+    EXPECT_EQ(sum_only.getPixelSum(3, 4, 40, 25), full.getPixelSum(3, 4, 40, 25));
+    EXPECT_THROW(static_cast<void>(sum_only.getNonZeroCount(0, 0, 1, 1)), std::runtime_error);
+    const std::vector<std::uint8_t> patch(4, 9);
+    sum_only.update(1, 1, 2, 2, patch);
+    EXPECT_EQ(sum_only.getPixelSum(1, 1, 2, 2), 36U);
+
+    PixelSumU8(data.data(), width, height, PixelSumOptions { .tables = PixelSumTables::NonZero }).save(path);
+    const auto nonzero_only = PixelSumU8::load(path);
+    EXPECT_EQ(nonzero_only.getNonZeroCount(3, 4, 40, 25), full.getNonZeroCount(3, 4, 40, 25));
+    EXPECT_THROW(static_cast<void>(nonzero_only.getPixelSum(0, 0, 1, 1)), std::runtime_error);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PixelSum_File_Test, GivenMismatchedFile_WhenLoad_ThenRuntimeErrorIsThrown)
+{
+    const auto path = std::filesystem::temp_directory_path() / "pixel_sum_mismatch_test.sat";
+    std::vector<std::uint8_t> data(64, 3);
+    PixelSumU8(data.data(), 8, 8).save(path);
+
+    EXPECT_NO_THROW(static_cast<void>(PixelSumU8::load(path)));
+    EXPECT_THROW(static_cast<void>(PixelSumU8Wide::load(path)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(PixelSumU16::load(path)), std::runtime_error);
+
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    EXPECT_THROW(static_cast<void>(PixelSumU8::load(path)), std::runtime_error);
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a table file, but long enough to hold a header........";
+    EXPECT_THROW(static_cast<void>(PixelSumU8::load(path)), std::runtime_error);
+
+    std::filesystem::remove(path);
+    EXPECT_THROW(static_cast<void>(PixelSumU8::load(path)), std::runtime_error);
+}
+
+TEST(PixelSum_Stream_Test, GivenPushedRows_WhenQueryArrivedRows_ThenFullBuildResultsAreReturned)
+{
+    const int width = 73;
+    const int height = 120;
+    const auto data = makeRandomPixels<std::uint16_t>(width, height, 107U);
+    const auto full = PixelSumU16(data.data(), width, height);
+    const auto windows = makeRandomWindows(width, height, 301, 109U);
+
+    PixelSumStreamU16 stream(width);
+    bool all_match = true;
+    for (int y = 0; y < height; ++y) {
+        stream.pushRow(std::span<const std::uint16_t>(data).subspan(static_cast<std::size_t>(y) * static_cast<std::size_t>(width)));
+        if (y % 17 != 0 && y + 1 != height) {
+            continue;
+        }
+
+        // Rows past the last one pushed are clamped away, like rows outside the full image.
+        const auto partial = PixelSumU16(data.data(), width, y + 1);
+        for (const auto& [x0, y0, x1, y1] : windows) {
+            all_match = all_match && stream.getPixelSum(x0, y0, x1, y1) == partial.getPixelSum(x0, y0, x1, y1)
+                && stream.getNonZeroCount(x0, y0, x1, y1) == partial.getNonZeroCount(x0, y0, x1, y1)
+                && stream.getPixelAverage(x0, y0, x1, y1) == partial.getPixelAverage(x0, y0, x1, y1)
+                && stream.getNonZeroAverage(x0, y0, x1, y1) == partial.getNonZeroAverage(x0, y0, x1, y1);
+        }
+    }
+    EXPECT_TRUE(all_match);
+    EXPECT_EQ(stream.rows(), height);
+    EXPECT_EQ(stream.getPixelSum(0, 0, width, height), full.getPixelSum(0, 0, width, height));
+}
+
+TEST(PixelSum_Stream_Test, GivenRingCapacity_WhenPushManyRows_ThenRecentWindowsStayExact)
+{
+    const int width = 4096;
+    const int capacity = 16;
+    std::vector<std::uint8_t> row(width, 255);
+
+    // The running sums wrap around 32 bits long before the last row; windows inside the ring must not notice.
+    PixelSumStreamU8 stream(width, capacity);
+    for (int y = 0; y < 5000; ++y) {
+        row[static_cast<std::size_t>(y % width)] = 0;
+        stream.pushRow(row);
+        row[static_cast<std::size_t>(y % width)] = 255;
+    }
+
+    EXPECT_EQ(stream.firstRow(), 5000 - capacity);
+    EXPECT_EQ(stream.getPixelSum(0, 5000 - capacity, width - 1, 4999), 255U * (width * capacity - capacity));
+    EXPECT_EQ(stream.getNonZeroCount(0, 4990, width - 1, 6000), static_cast<std::uint32_t>(width * 10 - 10));
+    EXPECT_EQ(stream.getPixelSum(4999 % width, 4999, 4999 % width, 4999), 0U);
+    EXPECT_THROW(static_cast<void>(stream.getPixelSum(0, 5000 - capacity - 1, 10, 4999)), std::runtime_error);
+    EXPECT_THROW(PixelSumStreamU8(width, 1 << 20), std::runtime_error);
+    EXPECT_THROW(stream.pushRow(std::span<const std::uint8_t>(row).first(width - 1)), std::runtime_error);
+}
+
+TEST(PixelSum_Variance_Test, GivenRandomWindows_WhenGetVariance_ThenTwoPassResultsAreReturned)
+{
+    const int width = 67;
+    const int height = 131;
+    auto data = makeRandomPixels<std::uint16_t>(width, height, 113U);
+    const auto windows = makeRandomWindows(width, height, 301, 127U);
+    std::vector<std::uint16_t> patch(12, 65535);
+
+    // Two-pass variance over the clamped window, optionally skipping zero pixels.
+    const auto reference = [&](PixelSumWindow window, bool nonzero_only) {
+        if (std::max(window.x0, window.x1) < 0 || std::min(window.x0, window.x1) >= width || std::max(window.y0, window.y1) < 0
+            || std::min(window.y0, window.y1) >= height) {
+            return 0.0;
+        }
+        const int x0 = std::clamp(std::min(window.x0, window.x1), 0, width - 1);
+        const int x1 = std::clamp(std::max(window.x0, window.x1), 0, width - 1);
+        const int y0 = std::clamp(std::min(window.y0, window.y1), 0, height - 1);
+        const int y1 = std::clamp(std::max(window.y0, window.y1), 0, height - 1);
+        std::vector<double> values;
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                const auto value = data[static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x)];
+                if (!nonzero_only || value > 0) {
+                    values.push_back(value);
+                }
+            }
+        }
+        double mean = 0.0;
+        for (const double value : values) {
+            mean += value / static_cast<double>(values.size());
+        }
+        double variance = 0.0;
+        for (const double value : values) {
+            variance += (value - mean) * (value - mean) / static_cast<double>(values.size());
+        }
+        return variance;
+    };
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Fenwick }) {
+        for (const unsigned int thread_count : { 1U, 3U }) {
+            data = makeRandomPixels<std::uint16_t>(width, height, 113U);
+            auto pixel_sum = PixelSumU16(
+                data.data(), width, height, PixelSumOptions { .thread_count = thread_count, .layout = layout, .with_squares = true });
+            pixel_sum.update(10, 20, 13, 22, patch);
+            for (int y = 20; y <= 22; ++y) {
+                std::fill_n(data.begin() + y * width + 10, 4, std::uint16_t { 65535 });
+            }
+
+            bool all_match = true;
+            for (const auto& window : windows) {
+                const auto [x0, y0, x1, y1] = window;
+                const double variance = reference(window, false);
+                const double nonzero_variance = reference(window, true);
+                all_match = all_match && std::abs(pixel_sum.getPixelVariance(x0, y0, x1, y1) - variance) <= 1e-9 * (1.0 + variance)
+                    && std::abs(pixel_sum.getNonZeroVariance(x0, y0, x1, y1) - nonzero_variance) <= 1e-9 * (1.0 + nonzero_variance)
+                    && pixel_sum.getPixelStdDev(x0, y0, x1, y1) == std::sqrt(pixel_sum.getPixelVariance(x0, y0, x1, y1));
+            }
+            EXPECT_TRUE(all_match);
+        }
+    }
+}
+
+TEST(PixelSum_Variance_Test, GivenNoSquaresTable_WhenGetVariance_ThenRuntimeErrorIsThrown)
+{
+    std::vector<std::uint8_t> data(16, 7);
+    const auto plain = PixelSumU8(data.data(), 4, 4);
+    const auto with_squares = PixelSumU8(data.data(), 4, 4, PixelSumOptions { .with_squares = true });
+
+    EXPECT_THROW(static_cast<void>(plain.getPixelVariance(0, 0, 3, 3)), std::runtime_error);
+    EXPECT_EQ(with_squares.getPixelVariance(0, 0, 3, 3), 0.0);
+    EXPECT_EQ(with_squares.getNonZeroStdDev(5, 5, 6, 6), 0.0);
+}
+
+TEST(PixelSum_Rotated_Test, GivenTiltedWindows_WhenGetRotatedSum_ThenBruteForceSumsAreReturned)
+{
+    const int width = 41;
+    const int height = 29;
+    auto data = makeRandomPixels<std::uint8_t>(width, height, 131U);
+    std::vector<std::uint8_t> patch(15, 250);
+
+    // Pixels with x + y <= i + j < x + y + 2w and y - x <= j - i < y - x + 2h.
+    const auto reference = [&](int x, int y, int w, int h) {
+        std::uint32_t sum = 0;
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                if (i + j >= x + y && i + j < x + y + 2 * w && j - i >= y - x && j - i < y - x + 2 * h) {
+                    sum += data[static_cast<std::size_t>(j) * static_cast<std::size_t>(width) + static_cast<std::size_t>(i)];
+                }
+            }
+        }
+        return sum;
+    };
+
+    std::mt19937 engine(137U);
+    std::uniform_int_distribution<int> x(-20, width + 20);
+    std::uniform_int_distribution<int> y(-20, height + 20);
+    std::uniform_int_distribution<int> size(0, 40);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Fenwick }) {
+        data = makeRandomPixels<std::uint8_t>(width, height, 131U);
+        auto pixel_sum = PixelSumU8(data.data(), width, height, PixelSumOptions { .layout = layout, .with_rotated = true });
+        EXPECT_EQ(pixel_sum.getRotatedSum(10, 3, 1, 1),
+                  static_cast<std::uint32_t>(data[3 * width + 10]) + data[4 * width + 10]);
+        EXPECT_EQ(pixel_sum.getRotatedSum(0, -width - 5, 1000, 1000), pixel_sum.getPixelSum(0, 0, width - 1, height - 1));
+
+        for (int round = 0; round < 2; ++round) {
+            bool all_match = true;
+            for (int i = 0; i < 500; ++i) {
+                const int wx = x(engine);
+                const int wy = y(engine);
+                const int ww = size(engine);
+                const int wh = size(engine);
+                all_match = all_match && pixel_sum.getRotatedSum(wx, wy, ww, wh) == reference(wx, wy, ww, wh);
+            }
+            EXPECT_TRUE(all_match);
+
+            pixel_sum.update(7, 11, 11, 13, patch);
+            for (int j = 11; j <= 13; ++j) {
+                std::fill_n(data.begin() + j * width + 7, 5, std::uint8_t { 250 });
+            }
+        }
+    }
+
+    std::vector<std::uint8_t> plain(16, 1);
+    EXPECT_THROW(static_cast<void>(PixelSumU8(plain.data(), 4, 4).getRotatedSum(1, 1, 1, 1)), std::runtime_error);
+}
+
+TEST(PixelSum_Histogram_Test, GivenRandomWindows_WhenGetHistogram_ThenBruteForceCountsAreReturned)
+{
+    const int width = 53;
+    const int height = 47;
+    const auto windows = makeRandomWindows(width, height, 301, 139U);
+    std::vector<std::uint16_t> patch(20, 40000);
+
+    for (const auto& options : { PixelSumOptions { .histogram_bins = 16 },
+                                 PixelSumOptions { .layout = PixelSumLayout::Fenwick, .histogram_edges = { 1, 100, 30000, 65535 } } }) {
+        auto data = makeRandomPixels<std::uint16_t>(width, height, 149U);
+        auto pixel_sum = PixelSumU16(data.data(), width, height, options);
+        const auto edges = pixel_sum.getHistogramEdges();
+        const std::size_t bins = edges.size() - 1;
+        EXPECT_EQ(edges.front(), 0U);
+        EXPECT_EQ(edges.back(), 65536U);
+
+        const auto reference = [&](PixelSumWindow window) {
+            std::vector<std::uint64_t> counts(bins, 0);
+            for (int y = std::max(std::min(window.y0, window.y1), 0); y <= std::min(std::max(window.y0, window.y1), height - 1); ++y) {
+                for (int x = std::max(std::min(window.x0, window.x1), 0); x <= std::min(std::max(window.x0, window.x1), width - 1); ++x) {
+                    const auto value = data[static_cast<std::size_t>(y) * static_cast<std::size_t>(width) + static_cast<std::size_t>(x)];
+                    const auto bin = std::upper_bound(edges.begin(), edges.end(), value) - edges.begin() - 1;
+                    ++counts[static_cast<std::size_t>(bin)];
+                }
+            }
+            return counts;
+        };
+
+        for (int round = 0; round < 2; ++round) {
+            bool all_match = true;
+            std::vector<std::uint64_t> histogram(bins);
+            for (const auto& window : windows) {
+                pixel_sum.getHistogram(window.x0, window.y0, window.x1, window.y1, histogram);
+                all_match = all_match && histogram == reference(window);
+            }
+            EXPECT_TRUE(all_match);
+
+            pixel_sum.update(30, 40, 34, 43, patch);
+            for (int y = 40; y <= 43; ++y) {
+                std::fill_n(data.begin() + y * width + 30, 5, std::uint16_t { 40000 });
+            }
+        }
+    }
+}
+
+TEST(PixelSum_Histogram_Test, GivenSingleValueBins_WhenGetPercentile_ThenSortedPixelsAreReturned)
+{
+    const int width = 31;
+    const int height = 37;
+    const auto data = makeRandomPixels<std::uint8_t>(width, height, 151U);
+    const auto pixel_sum = PixelSumU8(data.data(), width, height, PixelSumOptions { .histogram_bins = 256 });
+
+    // With one pixel value per bin the interpolated percentile lies between the exact one and the next value.
+    std::vector<std::uint8_t> window;
+    for (int y = 5; y <= 20; ++y) {
+        window.insert(window.end(), data.begin() + y * width + 3, data.begin() + y * width + 28);
+    }
+    std::sort(window.begin(), window.end());
+
+    bool all_match = true;
+    for (const double percentile : { 1.0, 10.0, 50.0, 90.0, 100.0 }) {
+        const auto rank = static_cast<std::size_t>(std::ceil(percentile / 100.0 * static_cast<double>(window.size())));
+        const double exact = window[rank - 1];
+        const double approximate = pixel_sum.getPercentile(3, 5, 27, 20, percentile);
+        all_match = all_match && approximate >= exact && approximate <= exact + 1.0;
+    }
+    EXPECT_TRUE(all_match);
+    EXPECT_EQ(pixel_sum.getPercentile(-10, -10, -5, -5, 50.0), 0.0);
+
+    std::vector<std::uint32_t> too_small(255);
+    EXPECT_THROW(pixel_sum.getHistogram(0, 0, 1, 1, too_small), std::runtime_error);
+    EXPECT_THROW(PixelSumU8(data.data(), width, height, PixelSumOptions { .histogram_bins = 257 }), std::runtime_error);
+    EXPECT_THROW(PixelSumU8(data.data(), width, height, PixelSumOptions { .histogram_edges = { 10, 10 } }), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(PixelSumU8(data.data(), width, height).getPercentile(0, 0, 1, 1, 50.0)), std::runtime_error);
+}
+
+TEST(PixelSum_Stats_Test, GivenQueriesOnSeveralThreads_WhenReadCounters_ThenEveryQueryIsCounted)
+{
+    const int width = 40;
+    const int height = 30;
+    const auto data = makeRandomPixels<std::uint8_t>(width, height, 163U);
+    resetPixelSumCounters();
+    const auto before = pixelSumCounters();
+
+    {
+        const auto pixel_sum = PixelSumU8(data.data(), width, height);
+        const auto copy = pixel_sum;
+        EXPECT_EQ(pixel_sum.instanceStats().bytes >= 2 * sizeof(std::uint32_t) * width * height, true);
+
+        // Counters of exited threads are kept.
+        std::thread worker([&pixel_sum] {
+            for (int i = 0; i < 100; ++i) {
+                static_cast<void>(pixel_sum.getPixelSum(0, 0, i % width, 5));
+            }
+        });
+        worker.join();
+        static_cast<void>(pixel_sum.getPixelSum(-5, -5, 10, 10));
+        static_cast<void>(pixel_sum.getNonZeroCount(50, 0, 60, 10));
+        static_cast<void>(pixel_sum.getPixelAverage(0, 0, 1, 1));
+        static_cast<void>(copy.getNonZeroAverage(0, 0, 1, 1));
+
+        const auto during = pixelSumCounters();
+        if (pixelSumStatsEnabled()) {
+            EXPECT_EQ(during.sum_queries - before.sum_queries, 101U);
+            EXPECT_EQ(during.nonzero_count_queries - before.nonzero_count_queries, 1U);
+            EXPECT_EQ(during.average_queries - before.average_queries, 1U);
+            EXPECT_EQ(during.nonzero_average_queries - before.nonzero_average_queries, 1U);
+            EXPECT_EQ(during.clamped_windows - before.clamped_windows, 1U);
+            EXPECT_EQ(during.empty_windows - before.empty_windows, 1U);
+            EXPECT_EQ(during.builds - before.builds, 1U);
+            EXPECT_EQ(during.build_bytes - before.build_bytes, pixel_sum.instanceStats().bytes);
+            EXPECT_EQ(during.live_instances - before.live_instances, 2U);
+            EXPECT_EQ(during.live_bytes - before.live_bytes, 2 * pixel_sum.instanceStats().bytes);
+        } else {
+            EXPECT_EQ(during.sum_queries, 0U);
+            EXPECT_EQ(during.live_instances, 0U);
+            EXPECT_EQ(pixel_sum.instanceStats().build_nanoseconds, 0U);
+        }
+    }
+
+    const auto after = pixelSumCounters();
+    EXPECT_EQ(after.live_instances, before.live_instances);
+    EXPECT_EQ(after.live_bytes, before.live_bytes);
+
+    std::ostringstream exported;
+    writePixelSumCounters(exported, after);
+    EXPECT_EQ(exported.str().find("pixel_sum_sum_queries ") == 0, true);
+
+    resetPixelSumCounters();
+    EXPECT_EQ(pixelSumCounters().sum_queries, 0U);
+}
+
+TEST(PixelSum_Stats_Test, GivenVarianceQueries_WhenReadCounters_ThenEachQueryIsCountedOnce)
+{
+    const auto data = makeRandomPixels<std::uint8_t>(40, 30, 179U);
+    const auto pixel_sum = PixelSumU8(data.data(), 40, 30, PixelSumOptions { .with_squares = true });
+    const auto before = pixelSumCounters();
+
+    static_cast<void>(pixel_sum.getPixelVariance(-5, -5, 10, 10));
+    static_cast<void>(pixel_sum.getPixelStdDev(0, 0, 9, 9));
+    static_cast<void>(pixel_sum.getNonZeroVariance(0, 0, 9, 9));
+    static_cast<void>(pixel_sum.getNonZeroStdDev(50, 0, 60, 10));
+
+    // Only the variance counters move; the sums and counts behind them are not counted as getter queries.
+    const auto after = pixelSumCounters();
+    EXPECT_EQ(after.variance_queries - before.variance_queries, pixelSumStatsEnabled() ? 2U : 0U);
+    EXPECT_EQ(after.nonzero_variance_queries - before.nonzero_variance_queries, pixelSumStatsEnabled() ? 2U : 0U);
+    EXPECT_EQ(after.clamped_windows - before.clamped_windows, pixelSumStatsEnabled() ? 1U : 0U);
+    EXPECT_EQ(after.empty_windows - before.empty_windows, pixelSumStatsEnabled() ? 1U : 0U);
+    EXPECT_EQ(after.sum_queries, before.sum_queries);
+    EXPECT_EQ(after.nonzero_count_queries, before.nonzero_count_queries);
+}
+
+TEST(PixelSum_Stats_Test, GivenHistogramAndRotatedQueries_WhenReadCounters_ThenEachQueryIsCountedOnce)
+{
+    const auto data = makeRandomPixels<std::uint8_t>(40, 30, 181U);
+    const auto pixel_sum = PixelSumU8(data.data(), 40, 30, PixelSumOptions { .with_rotated = true, .histogram_bins = 16 });
+    std::vector<std::uint32_t> histogram(16);
+    const auto before = pixelSumCounters();
+
+    pixel_sum.getHistogram(-5, -5, 10, 10, histogram);
+    static_cast<void>(pixel_sum.getPercentile(0, 0, 9, 9, 50.0));
+    static_cast<void>(pixel_sum.getPercentile(50, 0, 60, 10, 50.0));
+    // Rotated windows count by their bounding box: inside, cut at the left border, and below the image.
+    static_cast<void>(pixel_sum.getRotatedSum(20, 5, 4, 3));
+    static_cast<void>(pixel_sum.getRotatedSum(1, 0, 5, 5));
+    static_cast<void>(pixel_sum.getRotatedSum(10, 100, 2, 2));
+
+    // getPercentile() reads the histogram without counting a histogram query.
+    const auto after = pixelSumCounters();
+    const auto expected = [](std::uint64_t count) { return pixelSumStatsEnabled() ? count : 0U; };
+    EXPECT_EQ(after.histogram_queries - before.histogram_queries, expected(1));
+    EXPECT_EQ(after.percentile_queries - before.percentile_queries, expected(2));
+    EXPECT_EQ(after.rotated_queries - before.rotated_queries, expected(3));
+    EXPECT_EQ(after.clamped_windows - before.clamped_windows, expected(2));
+    EXPECT_EQ(after.empty_windows - before.empty_windows, expected(2));
+    EXPECT_EQ(after.sum_queries, before.sum_queries);
+
+    std::ostringstream exported;
+    writePixelSumCounters(exported, after);
+    EXPECT_TRUE(exported.str().find("pixel_sum_rotated_queries ") != std::string::npos);
+}
+
+TEST(PixelSum_Fixed_Test, GivenFixedPatch_WhenCallGetters_ThenRuntimeDimensionResultsAreReturned)
+{
+    constexpr int width = 32;
+    constexpr int height = 24;
+    const auto data = makeRandomPixels<std::uint8_t>(width, height, 167U);
+    const auto windows = makeRandomWindows(width, height, 2001, 173U);
+    const auto pixel_sum = PixelSumU8(data.data(), width, height);
+
+    const auto allocations = allocation_count.load();
+    const PixelSumFixedU8<width, height> fixed(data.data());
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+
+    bool all_match = true;
+    for (const auto& [x0, y0, x1, y1] : windows) {
+        all_match = all_match && fixed.getPixelSum(x0, y0, x1, y1) == pixel_sum.getPixelSum(x0, y0, x1, y1)
+            && fixed.getNonZeroCount(x0, y0, x1, y1) == pixel_sum.getNonZeroCount(x0, y0, x1, y1)
+            && fixed.getPixelAverage(x0, y0, x1, y1) == pixel_sum.getPixelAverage(x0, y0, x1, y1)
+            && fixed.getNonZeroAverage(x0, y0, x1, y1) == pixel_sum.getNonZeroAverage(x0, y0, x1, y1);
+    }
+    EXPECT_TRUE(all_match);
+
+    // The tables can be built at compile time.
+    constexpr std::array<std::uint16_t, 6> pixels { 0, 4, 0, 2, 1, 0 };
+    constexpr PixelSumFixedU16<3, 2> constant(pixels.data());
+    static_assert(constant.getPixelSum(0, 0, 2, 1) == 7);
+    static_assert(constant.getNonZeroCount(-5, 1, 5, 1) == 2);
+
+    const std::vector<std::uint8_t> too_small(width * height - 1);
+    EXPECT_THROW((PixelSumFixedU8<width, height>(std::span<const std::uint8_t>(too_small))), std::runtime_error);
+}
+
+TEST(PixelSum_Fixed_Test, GivenValidWindows_WhenCallUncheckedGetters_ThenCheckedResultsAreReturned)
+{
+    const int width = 57;
+    const int height = 43;
+    const auto data = makeRandomPixels<std::uint16_t>(width, height, 179U);
+
+    std::mt19937 engine(181U);
+    std::uniform_int_distribution<int> x(0, width - 1);
+    std::uniform_int_distribution<int> y(0, height - 1);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        const auto pixel_sum = PixelSumU16(data.data(), width, height, PixelSumOptions { .layout = layout });
+
+        bool all_match = true;
+        for (int i = 0; i < 500; ++i) {
+            const auto [x0, x1] = std::minmax({ x(engine), x(engine) });
+            const auto [y0, y1] = std::minmax({ y(engine), y(engine) });
+            all_match = all_match && pixel_sum.getPixelSumUnchecked(x0, y0, x1, y1) == pixel_sum.getPixelSum(x0, y0, x1, y1)
+                && pixel_sum.getNonZeroCountUnchecked(x0, y0, x1, y1) == pixel_sum.getNonZeroCount(x0, y0, x1, y1)
+                && pixel_sum.getPixelAverageUnchecked(x0, y0, x1, y1) == pixel_sum.getPixelAverage(x0, y0, x1, y1)
+                && pixel_sum.getNonZeroAverageUnchecked(x0, y0, x1, y1) == pixel_sum.getNonZeroAverage(x0, y0, x1, y1);
+        }
+        EXPECT_TRUE(all_match);
+    }
+}
+
+TEST(PixelSum_Channels_Test, GivenInterleavedPixels_WhenCallGetters_ThenPerPlaneResultsAreReturned)
+{
+    const int width = 45;
+    const int height = 38;
+    const auto windows = makeRandomWindows(width, height, 301, 191U);
+
+    for (const int channels : { 1, 3, 4, 6 }) {
+        const auto data = makeRandomPixels<std::uint8_t>(width * channels, height, 193U + static_cast<unsigned int>(channels));
+        const auto pixel_sum = PixelSumChannelsU8(data, width, height, channels);
+
+        bool all_match = true;
+        std::vector<PixelSumStats<std::uint32_t>> stats(static_cast<std::size_t>(channels));
+        for (int c = 0; c < channels; ++c) {
+            std::vector<std::uint8_t> plane(static_cast<std::size_t>(width * height));
+            for (std::size_t i = 0; i < plane.size(); ++i) {
+                plane[i] = data[i * static_cast<std::size_t>(channels) + static_cast<std::size_t>(c)];
+            }
+            const auto reference = PixelSumU8(plane.data(), width, height);
+
+            for (const auto& [x0, y0, x1, y1] : windows) {
+                pixel_sum.getChannelStats(x0, y0, x1, y1, stats);
+                const auto& channel = stats[static_cast<std::size_t>(c)];
+                all_match = all_match && pixel_sum.getPixelSum(c, x0, y0, x1, y1) == reference.getPixelSum(x0, y0, x1, y1)
+                    && pixel_sum.getNonZeroCount(c, x0, y0, x1, y1) == reference.getNonZeroCount(x0, y0, x1, y1)
+                    && pixel_sum.getPixelAverage(c, x0, y0, x1, y1) == reference.getPixelAverage(x0, y0, x1, y1)
+                    && pixel_sum.getNonZeroAverage(c, x0, y0, x1, y1) == reference.getNonZeroAverage(x0, y0, x1, y1)
+                    && channel.sum == reference.getPixelSum(x0, y0, x1, y1)
+                    && channel.nonzero_count == reference.getNonZeroCount(x0, y0, x1, y1)
+                    && channel.pixel_average == reference.getPixelAverage(x0, y0, x1, y1)
+                    && channel.nonzero_average == reference.getNonZeroAverage(x0, y0, x1, y1);
+            }
+        }
+        EXPECT_TRUE(all_match);
+    }
+
+    const std::vector<std::uint16_t> rgb(static_cast<std::size_t>(3 * width * height), 65535);
+    const auto saturated = PixelSumChannelsU16(rgb.data(), width, height, 3);
+    EXPECT_EQ(saturated.getPixelSum(2, 0, 0, width - 1, height - 1), 65535ULL * width * height);
+}
+
+TEST(PixelSum_Channels_Test, GivenInvalidArguments_WhenContructionOrQuery_ThenRuntimeErrorIsThrown)
+{
+    const std::vector<std::uint8_t> data(4 * 5 * 3);
+    EXPECT_THROW(PixelSumChannelsU8(data, 4, 5, 0), std::runtime_error);
+    EXPECT_THROW(PixelSumChannelsU8(data, 4, 5, 4), std::runtime_error);
+
+    const auto pixel_sum = PixelSumChannelsU8(data, 4, 5, 3);
+    std::vector<PixelSumStats<std::uint32_t>> too_small(2);
+    EXPECT_THROW(static_cast<void>(pixel_sum.getPixelSum(3, 0, 0, 1, 1)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(pixel_sum.getNonZeroCount(-1, 0, 0, 1, 1)), std::runtime_error);
+    EXPECT_THROW(pixel_sum.getChannelStats(0, 0, 1, 1, too_small), std::runtime_error);
+}
+
+TEST(PixelSum_Image_Test, GivenPitchedRegion_WhenContruction_ThenPackedBuildResultsAreReturned)
+{
+    const int full_width = 97;
+    const int full_height = 81;
+    const std::size_t pitch = 112;
+    const int x = 13;
+    const int y = 7;
+    const int width = 64;
+    const int height = 70;
+
+    // Rows padded to `pitch` with non-zero garbage, which must never be read.
+    std::vector<std::uint16_t> padded(pitch * full_height, 4321);
+    const auto pixels = makeRandomPixels<std::uint16_t>(full_width, full_height, 197U);
+    for (int row = 0; row < full_height; ++row) {
+        std::copy_n(pixels.begin() + row * full_width, full_width, padded.begin() + static_cast<std::ptrdiff_t>(row * pitch));
+    }
+    std::vector<std::uint16_t> packed;
+    for (int row = y; row < y + height; ++row) {
+        packed.insert(packed.end(), pixels.begin() + row * full_width + x, pixels.begin() + row * full_width + x + width);
+    }
+
+    const auto image = PixelSumImage<std::uint16_t>::fromPitch(padded.data(), full_width, full_height, pitch * sizeof(std::uint16_t));
+    const auto roi = image.roi(x, y, width, height);
+    const auto windows = makeRandomWindows(width, height, 401, 199U);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        for (const unsigned int thread_count : { 1U, 3U }) {
+            const PixelSumOptions options {
+                .thread_count = thread_count, .layout = layout, .with_squares = true, .with_rotated = true, .histogram_bins = 8
+            };
+            // Reading in place allocates exactly what a packed build does: no staging copy of the region.
+            auto allocations = allocation_count.load();
+            const auto expected = PixelSumU16(packed.data(), width, height, options);
+            const auto packed_allocations = allocation_count.load() - allocations;
+            allocations = allocation_count.load();
+            const auto actual = PixelSumU16(roi, options);
+            EXPECT_EQ(allocation_count.load() - allocations, packed_allocations);
+
+            std::vector<std::uint64_t> expected_histogram(8);
+            std::vector<std::uint64_t> actual_histogram(8);
+            bool all_match = matchesReference(actual, packed, width, height);
+            for (const auto& [x0, y0, x1, y1] : windows) {
+                expected.getHistogram(x0, y0, x1, y1, expected_histogram);
+                actual.getHistogram(x0, y0, x1, y1, actual_histogram);
+                all_match = all_match && actual.getPixelVariance(x0, y0, x1, y1) == expected.getPixelVariance(x0, y0, x1, y1)
+                    && actual.getRotatedSum(x0, y0, 5, 4) == expected.getRotatedSum(x0, y0, 5, 4)
+                    && actual_histogram == expected_histogram;
+            }
+            EXPECT_TRUE(all_match);
+        }
+    }
+}
+
+TEST(PixelSum_Image_Test, GivenInvalidImage_WhenContruction_ThenRuntimeErrorIsThrown)
+{
+    const std::vector<std::uint8_t> data(10 * 10);
+    const auto image = PixelSumImage<std::uint8_t> { data.data(), 10, 10, 10 };
+
+    EXPECT_THROW(static_cast<void>(image.roi(5, 5, 6, 1)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(image.roi(-1, 0, 2, 2)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(PixelSumImage<std::uint16_t>::fromPitch(nullptr, 4, 4, 9)), std::runtime_error);
+    EXPECT_THROW(PixelSumU8(PixelSumImage<std::uint8_t> { data.data(), 10, 10, 9 }), std::runtime_error);
+    EXPECT_THROW(PixelSumU8(PixelSumImage<std::uint8_t> { data.data(), 0, 10, 10 }), std::runtime_error);
+
+    auto pixel_sum = PixelSumU8(image.roi(2, 3, 4, 5));
+    EXPECT_EQ(pixel_sum.getPixelSum(0, 0, 100, 100), 0U);
+    EXPECT_NO_THROW(pixel_sum.rebuild(image));
+    EXPECT_EQ(pixel_sum.getNonZeroCount(9, 9, 9, 9), 0U);
+}
+
+TEST(PixelSum_Tables_Test, GivenPartialTables_WhenCallGetters_ThenFullBuildResultsAreReturned)
+{
+    const int width = 73;
+    const int height = 58;
+    auto pixels = makeRandomPixels<std::uint8_t>(width, height, 211U);
+    const auto windows = makeRandomWindows(width, height, 301, 223U);
+
+    auto full = PixelSumU8(pixels.data(), width, height);
+    auto sum_only = PixelSumU8(pixels.data(), width, height, PixelSumOptions { .tables = PixelSumTables::Sum });
+    const auto nonzero_only = PixelSumU8(pixels.data(), width, height, PixelSumOptions { .tables = PixelSumTables::NonZero });
+    EXPECT_TRUE(static_cast<bool>(sum_only) && static_cast<bool>(nonzero_only));
+    // One table plus a few scratch rows.
+    EXPECT_TRUE(sum_only.instanceStats().bytes < full.instanceStats().bytes * 3 / 5);
+
+    bool all_match = true;
+    for (const auto& [x0, y0, x1, y1] : windows) {
+        all_match = all_match && sum_only.getPixelSum(x0, y0, x1, y1) == full.getPixelSum(x0, y0, x1, y1)
+            && sum_only.getPixelAverage(x0, y0, x1, y1) == full.getPixelAverage(x0, y0, x1, y1)
+            && nonzero_only.getNonZeroCount(x0, y0, x1, y1) == full.getNonZeroCount(x0, y0, x1, y1);
+    }
+    EXPECT_TRUE(all_match);
+
+    std::vector<double> expected(pixels.size());
+    std::vector<double> actual(pixels.size());
+    full.boxFilter(3, PixelSumStatistic::Average, expected);
+    sum_only.boxFilter(3, PixelSumStatistic::Average, actual);
+    EXPECT_TRUE(actual == expected);
+
+    EXPECT_THROW(static_cast<void>(sum_only.getNonZeroCount(0, 0, 1, 1)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(sum_only.getNonZeroAverage(0, 0, 1, 1)), std::runtime_error);
+    EXPECT_THROW(static_cast<void>(nonzero_only.getPixelSum(0, 0, 1, 1)), std::runtime_error);
+    EXPECT_THROW(PixelSumU8(pixels.data(), width, height, PixelSumOptions { .tables = PixelSumTables::None }), std::runtime_error);
+
+    // Updates read old pixels back from the sum table, so they work without the non-zero one.
+    const std::vector<std::uint8_t> patch(6 * 5, 0);
+    for (int y = 9; y < 14; ++y) {
+        std::fill_n(pixels.begin() + y * width + 20, 6, std::uint8_t { 0 });
+    }
+    full.update(20, 9, 25, 13, patch);
+    sum_only.update(20, 9, 25, 13, patch);
+    EXPECT_EQ(sum_only.getPixelSum(0, 0, width - 1, height - 1), full.getPixelSum(0, 0, width - 1, height - 1));
+    EXPECT_EQ(sum_only.getPixelSum(15, 5, 40, 30), full.getPixelSum(15, 5, 40, 30));
+    auto nonzero_copy = nonzero_only;
+    EXPECT_THROW(nonzero_copy.update(20, 9, 25, 13, patch), std::runtime_error);
+}
+
+TEST(PixelSum_Tables_Test, GivenLazyObject_WhenQueryOnSeveralThreads_ThenEagerResultsAreReturned)
+{
+    const int width = 91;
+    const int height = 67;
+    const auto pixels = makeRandomPixels<std::uint16_t>(width, height, 227U);
+    const auto next = makeRandomPixels<std::uint16_t>(width, height, 229U);
+    const auto windows = makeRandomWindows(width, height, 257, 233U);
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Tiled, PixelSumLayout::Compact, PixelSumLayout::Fenwick, PixelSumLayout::Sparse }) {
+        const PixelSumOptions options { .layout = layout, .with_squares = true, .lazy = true };
+        const auto eager = PixelSumU16(pixels.data(), width, height, PixelSumOptions { .layout = layout, .with_squares = true });
+        auto lazy = PixelSumU16(pixels.data(), width, height, options);
+        EXPECT_TRUE(static_cast<bool>(lazy));
+
+        // Every thread's first query races to build the tables.
+        std::array<bool, 4> matches {};
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < matches.size(); ++i) {
+            threads.emplace_back([&, i] {
+                bool all_match = true;
+                for (const auto& [x0, y0, x1, y1] : windows) {
+                    // Checking the object while other threads build its tables is safe too.
+                    all_match = all_match && static_cast<bool>(lazy);
+                    if (i % 3 == 0) {
+                        all_match = all_match && lazy.getNonZeroAverage(x0, y0, x1, y1) == eager.getNonZeroAverage(x0, y0, x1, y1);
+                    } else if (i % 3 == 1) {
+                        all_match = all_match && lazy.getPixelSum(x0, y0, x1, y1) == eager.getPixelSum(x0, y0, x1, y1);
+                    } else {
+                        all_match = all_match && lazy.getPixelVariance(x0, y0, x1, y1) == eager.getPixelVariance(x0, y0, x1, y1);
+                    }
+                }
+                matches[i] = all_match;
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_TRUE(std::all_of(matches.begin(), matches.end(), [](bool match) { return match; }));
+        EXPECT_TRUE(matchesReference(lazy, pixels, width, height));
+
+        // A rebuilt lazy object reads the new pixels, and a copy taken before the first query builds its own tables.
+        lazy.rebuild(std::span<const std::uint16_t>(next), width, height);
+        const auto copy = lazy;
+        EXPECT_TRUE(matchesReference(copy, next, width, height));
+        EXPECT_TRUE(matchesReference(lazy, next, width, height));
+        EXPECT_EQ(lazy.getPixelVariance(3, 4, 50, 60), PixelSumU16(next.data(), width, height, options).getPixelVariance(3, 4, 50, 60));
+    }
+}
+
+TEST(PixelSum_Tables_Test, GivenLazyObjectWithOptionalTables_WhenTheyAreNotQueried_ThenTheyAreNeverBuilt)
+{
+    const int width = 91;
+    const int height = 67;
+    const auto pixels = makeRandomPixels<std::uint8_t>(width, height, 239U);
+    const auto area = static_cast<std::uint64_t>(width) * height;
+
+    for (const auto layout : { PixelSumLayout::RowMajor, PixelSumLayout::Fenwick }) {
+        const PixelSumOptions options { .layout = layout, .with_squares = true, .with_rotated = true, .histogram_bins = 16 };
+        auto lazy_options = options;
+        lazy_options.lazy = true;
+        const auto eager = PixelSumU8(pixels.data(), width, height, options);
+        const auto plain = PixelSumU8(pixels.data(), width, height, PixelSumOptions { .layout = layout });
+        const auto lazy = PixelSumU8(pixels.data(), width, height, lazy_options);
+
+        // Each optional table takes at least 4 bytes a pixel, so none of them is there after a sum query.
+        EXPECT_EQ(lazy.getPixelSum(2, 3, 60, 50), eager.getPixelSum(2, 3, 60, 50));
+        const auto sums_only = lazy.instanceStats().bytes;
+        EXPECT_TRUE(sums_only < plain.instanceStats().bytes + area);
+
+        // A variance query builds the squares alone, and the other queries the table each of them reads.
+        EXPECT_EQ(lazy.getPixelVariance(4, 1, 70, 66), eager.getPixelVariance(4, 1, 70, 66));
+        const auto with_squares = lazy.instanceStats().bytes;
+        EXPECT_TRUE(with_squares >= sums_only + 8 * area);
+        EXPECT_TRUE(with_squares < sums_only + 9 * area);
+        EXPECT_EQ(lazy.getRotatedSum(30, 5, 20, 12), eager.getRotatedSum(30, 5, 20, 12));
+        EXPECT_TRUE(lazy.instanceStats().bytes < eager.instanceStats().bytes);
+
+        std::array<std::uint32_t, 16> histogram {};
+        std::array<std::uint32_t, 16> expected {};
+        lazy.getHistogram(10, 10, 80, 40, histogram);
+        eager.getHistogram(10, 10, 80, 40, expected);
+        EXPECT_TRUE(histogram == expected);
+        EXPECT_EQ(lazy.getNonZeroVariance(0, 0, width - 1, height - 1), eager.getNonZeroVariance(0, 0, width - 1, height - 1));
+        EXPECT_TRUE(matchesReference(lazy, pixels, width, height));
+    }
+}
+
+TEST(PixelSum_Snapshots_Test, GivenPublishingWriter_WhenReadersQuery_ThenEverySnapshotIsConsistent)
+{
+    // Frame v is flat with value v % 200 + 1, and changes size every 5 frames, so recycled snapshots get resized.
+    const auto dimensions = [](std::uint64_t version) { return version / 5 % 2 == 0 ? std::pair { 64, 48 } : std::pair { 80, 40 }; };
+    const auto frame = [&dimensions](std::uint64_t version) {
+        const auto [width, height] = dimensions(version);
+        return std::vector<std::uint8_t>(static_cast<std::size_t>(width) * height, static_cast<std::uint8_t>(version % 200 + 1));
+    };
+    const std::uint64_t frames = 300;
+
+    PixelSumSnapshotsU8 live(frame(0), 64, 48, PixelSumOptions { .with_squares = true });
+    std::atomic<bool> stop { false };
+    std::atomic<int> torn { 0 };
+    std::atomic<int> reversed { 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            auto reader = live.reader();
+            std::uint64_t last = 0;
+            while (!stop.load()) {
+                const auto snapshot = reader.acquire();
+                const std::uint64_t version = snapshot.version();
+                const auto [width, height] = dimensions(version);
+                const auto area = static_cast<std::uint32_t>(width * height);
+                torn += snapshot->getPixelSum(0, 0, width - 1, height - 1) != area * static_cast<std::uint32_t>(version % 200 + 1) ||
+                    snapshot->getNonZeroCount(0, 0, 1000, 1000) != area || snapshot->getPixelVariance(0, 0, width - 1, height - 1) != 0.0;
+                reversed += version < last;
+                last = version;
+            }
+        });
+    }
+    for (std::uint64_t version = 1; version <= frames; ++version) {
+        const auto [width, height] = dimensions(version);
+        live.publish(frame(version), width, height);
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(torn.load(), 0);
+    EXPECT_EQ(reversed.load(), 0);
+    EXPECT_EQ(live.version(), frames);
+    EXPECT_TRUE(live.snapshotCount() <= 2 + readers.size());
+}
+
+TEST(PixelSum_Snapshots_Test, GivenPinnedSnapshot_WhenPublish_ThenItIsKeptAndOthersAreRecycled)
+{
+    const int width = 37;
+    const int height = 29;
+    const std::vector<std::uint16_t> first(width * height, 3);
+    const std::vector<std::uint16_t> next(width * height, 5);
+
+    PixelSumSnapshotsU16 live(first, width, height);
+    auto reader = live.reader();
+    {
+        const auto pinned = reader.acquire();
+        EXPECT_THROW(static_cast<void>(reader.acquire()), std::runtime_error);
+        for (int i = 0; i < 3; ++i) {
+            live.publish(next, width, height);
+        }
+        // The pinned frame, the current one and a spare.
+        EXPECT_EQ(live.snapshotCount(), 3U);
+        EXPECT_EQ(pinned.version(), 0U);
+        EXPECT_EQ(pinned->getPixelSum(0, 0, width, height), 3U * width * height);
+    }
+
+    live.publish(next, width, height);
+    EXPECT_EQ(live.snapshotCount(), 2U);
+    // Same-sized frames are rebuilt into the spare without allocating.
+    const auto allocations = allocation_count.load();
+    for (int i = 0; i < 4; ++i) {
+        live.publish(first, width, height);
+    }
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+
+    const auto current = reader.acquire();
+    EXPECT_EQ(current.version(), 8U);
+    EXPECT_EQ(current->getPixelSum(0, 0, width, height), 3U * width * height);
+    EXPECT_THROW(live.publish(first, width + 1, height), std::runtime_error);
+    EXPECT_EQ(live.version(), 8U);
+    EXPECT_THROW(PixelSumSnapshotsU16(first, width, height, PixelSumOptions { .lazy = true }), std::runtime_error);
+}
+
+TEST(PixelSum_BatchBuild_Test, GivenManyPatches_WhenBatchContruction_ThenPixelSumResultsAreReturned)
+{
+    // Patches of random sizes, every fifth one a region of a wider frame, so rows are a stride apart.
+    std::mt19937 engine(263U);
+    std::uniform_int_distribution<int> side(1, 40);
+    const auto frame = makeRandomPixels<std::uint8_t>(64, 64, 269U);
+    std::vector<std::vector<std::uint8_t>> buffers;
+    std::vector<PixelSumImage<std::uint8_t>> images;
+    for (int i = 0; i < 600; ++i) {
+        const int width = side(engine);
+        const int height = side(engine);
+        buffers.push_back(makeRandomPixels<std::uint8_t>(width, height, 271U + static_cast<unsigned int>(i)));
+        std::fill_n(buffers.back().begin(), std::min(width, 5), std::uint8_t { 0 });
+        images.push_back(i % 5 == 0 ? PixelSumImage<std::uint8_t> { frame.data(), 64, 64, 64 }.roi(i % 24, 3, width, height)
+                                    : PixelSumImage<std::uint8_t> { buffers.back().data(), width, height, static_cast<std::size_t>(width) });
+    }
+
+    for (const unsigned int thread_count : { 1U, 4U }) {
+        const PixelSumBatchU8 batch(images, thread_count);
+        EXPECT_EQ(batch.size(), images.size());
+
+        bool all_match = true;
+        for (std::size_t i = 0; i < images.size(); ++i) {
+            const auto patch = batch[i];
+            const PixelSumU8 expected(images[i]);
+            all_match = all_match && patch.width() == images[i].width && patch.height() == images[i].height;
+            for (const auto& [x0, y0, x1, y1] : makeRandomWindows(patch.width() + 4, patch.height() + 4, 8, 277U + static_cast<unsigned int>(i))) {
+                const int x = x0 - 2;
+                const int y = y0 - 2;
+                all_match = all_match && patch.getPixelSum(x, y, x1 - 2, y1 - 2) == expected.getPixelSum(x, y, x1 - 2, y1 - 2)
+                    && patch.getPixelAverage(x, y, x1 - 2, y1 - 2) == expected.getPixelAverage(x, y, x1 - 2, y1 - 2)
+                    && patch.getNonZeroCount(x, y, x1 - 2, y1 - 2) == expected.getNonZeroCount(x, y, x1 - 2, y1 - 2)
+                    && patch.getNonZeroAverage(x, y, x1 - 2, y1 - 2) == expected.getNonZeroAverage(x, y, x1 - 2, y1 - 2);
+            }
+            const int x1 = patch.width() - 1;
+            const int y1 = patch.height() - 1;
+            all_match = all_match && patch.getPixelSumUnchecked(0, 0, x1, y1) == expected.getPixelSum(0, 0, x1, y1)
+                && patch.getNonZeroAverageUnchecked(0, 0, x1, y1) == expected.getNonZeroAverage(0, 0, x1, y1);
+        }
+        EXPECT_TRUE(all_match);
+    }
+}
+
+TEST(PixelSum_BatchBuild_Test, GivenBatch_WhenRebuild_ThenArenaIsReused)
+{
+    const auto pixels = makeRandomPixels<std::uint16_t>(30, 20, 281U);
+    const auto image = PixelSumImage<std::uint16_t> { pixels.data(), 30, 20, 30 };
+    std::vector<PixelSumImage<std::uint16_t>> images(100, image);
+    PixelSumBatchU16 batch(images);
+
+    // Smaller patches fit in the arena of the first build.
+    for (auto& entry : images) {
+        entry = image.roi(3, 4, 20, 10);
+    }
+    const auto allocations = allocation_count.load();
+    batch.rebuild(std::span(images).first(50));
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+    EXPECT_EQ(batch.size(), 50U);
+    EXPECT_EQ(batch.at(49).getPixelSum(0, 0, 100, 100), PixelSumU16(image.roi(3, 4, 20, 10)).getPixelSum(0, 0, 19, 9));
+
+    images[7] = PixelSumImage<std::uint16_t> { pixels.data(), 30, 20, 29 };
+    EXPECT_THROW(batch.rebuild(images), std::runtime_error);
+    EXPECT_EQ(batch.size(), 50U);
+    EXPECT_THROW(static_cast<void>(batch.at(50)), std::runtime_error);
+
+    batch.rebuild({});
+    EXPECT_EQ(batch.size(), 0U);
+}
+
+TEST(PixelSum_BatchBuild_Test, GivenThreadedBatch_WhenRebuild_ThenWorkersAreReused)
+{
+    const auto pixels = makeRandomPixels<std::uint8_t>(40, 30, 283U);
+    const auto next = makeRandomPixels<std::uint8_t>(40, 30, 293U);
+    std::vector<PixelSumImage<std::uint8_t>> images;
+    for (int i = 0; i < 200; ++i) {
+        images.push_back(PixelSumImage<std::uint8_t> { pixels.data(), 40, 30, 40 }.roi(i % 17, i % 13, 23, 17));
+    }
+    PixelSumBatchU8 batch(images, 4);
+
+    // The threads started by the constructor build every later frame, with no allocation.
+    for (auto& image : images) {
+        image.data = next.data() + (image.data - pixels.data());
+    }
+    const auto allocations = allocation_count.load();
+    for (int round = 0; round < 5; ++round) {
+        batch.rebuild(images);
+    }
+    batch.rebuild(std::span(images).first(3));
+    batch.rebuild(images);
+    EXPECT_EQ(allocation_count.load() - allocations, 0U);
+
+    // A copy and a moved-to batch build on threads of their own.
+    auto copy = batch;
+    copy.rebuild(std::span(images).first(100));
+    const auto moved = std::move(copy);
+    bool all_match = true;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        const PixelSumU8 expected(images[i]);
+        all_match = all_match && batch[i].getPixelSum(0, 0, 22, 16) == expected.getPixelSum(0, 0, 22, 16)
+            && batch[i].getNonZeroCount(3, 2, 15, 11) == expected.getNonZeroCount(3, 2, 15, 11)
+            && (i >= moved.size() || moved[i].getPixelSum(5, 4, 20, 16) == expected.getPixelSum(5, 4, 20, 16));
+    }
+    EXPECT_TRUE(all_match);
+    EXPECT_EQ(moved.size(), 100U);
+}
+
 int main(int argc, char* argv[])
 {
     // cases in problem description
@@ -229,11 +1795,15 @@ int main(int argc, char* argv[])
     CALL_TEST_TIMED(PixelSum_Unit_Test, GivenPixels_WhenParametrizedContruction_ThenPixelSumIsValid);
     CALL_TEST_TIMED(PixelSum_Unit_Test, GivenPixels_WhenCopyContruction_ThenPixelSumIsValid);
     CALL_TEST_TIMED(PixelSum_Unit_Test, GivenPixels_WhenAssignmentContruction_ThenPixelSumIsValid);
+    CALL_TEST_TIMED(PixelSum_Unit_Test, GivenPixels_WhenMoveContruction_ThenOnlyTargetIsValid);
+    CALL_TEST_TIMED(PixelSum_Unit_Test, GivenReleasedBuffer_WhenCallGetters_ThenExpectedResultsAreReturned);
 
     // bound check
     CALL_TEST_TIMED(PixelSum_BoundCheck_Test, GivenZeroPixel_WhenContruction_ThenRuntimeErrorIsThrown);
     CALL_TEST_TIMED(PixelSum_BoundCheck_Test, GivenValidPixels_WhenContruction_ThenNoErrorIsThrown);
     CALL_TEST_TIMED(PixelSum_BoundCheck_Test, GivenInvalidPixels_WhenContruction_ThenRuntimeErrorIsThrown);
+    CALL_TEST_TIMED(PixelSum_BoundCheck_Test, GivenWideStrip_WhenContruction_ThenNoErrorIsThrown);
+    CALL_TEST_TIMED(PixelSum_BoundCheck_Test, GivenOverflowingDimensions_WhenIsRepresentable_ThenWideAccumulatorIsRequired);
 
     // edge case
     CALL_TEST_TIMED(PixelSum_Smoke_Test, GivenOnePixel_WhenCallAllGetters_ThenExpectedResultsAreReturned);
@@ -244,5 +1814,90 @@ int main(int argc, char* argv[])
     // search window test
     CALL_TEST_TIMED(PixelSum_SearchWindow_Test, GivenPixels_WhenGetNonZeroCountWithSearchWindow_ThenExpectedNonZeroCountIsReturned);
 
+    // construction
+    CALL_TEST_TIMED(PixelSum_Build_Test, GivenRandomU8Pixels_WhenContruction_ThenIntegralImagesMatchReference);
+    CALL_TEST_TIMED(PixelSum_Build_Test, GivenRandomU16Pixels_WhenContruction_ThenIntegralImagesMatchReference);
+    CALL_TEST_TIMED(PixelSum_Build_Test, GivenRandomU8Pixels_WhenWideContruction_ThenIntegralImagesMatchReference);
+    CALL_TEST_TIMED(PixelSum_Build_Test, GivenRandomPixels_WhenParallelContruction_ThenIntegralImagesMatchReference);
+
+    // batch query
+    CALL_TEST_TIMED(PixelSum_Batch_Test, GivenRandomWindows_WhenGetWindowStats_ThenPerCallResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Batch_Test, GivenTooSmallResults_WhenGetWindowStats_ThenRuntimeErrorIsThrown);
+
+    // storage layout
+    CALL_TEST_TIMED(PixelSum_Layout_Test, GivenRandomPixels_WhenLayoutContruction_ThenRowMajorResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Layout_Test, GivenSaturatedPixels_WhenCompactContruction_ThenBlockSumsDoNotOverflow);
+    CALL_TEST_TIMED(PixelSum_Layout_Test, GivenLargeImage_WhenCompactContruction_ThenTablesTakeLessMemory);
+    CALL_TEST_TIMED(PixelSum_Layout_Test, GivenRandomPixels_WhenFenwickContruction_ThenRowMajorResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Layout_Test, GivenSparseMask_WhenSparseContruction_ThenRowMajorResultsAreReturned);
+
+    // incremental update
+    CALL_TEST_TIMED(PixelSum_Update_Test, GivenRandomPatches_WhenUpdate_ThenFreshBuildResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Update_Test, GivenOutOfBoundWindow_WhenUpdate_ThenRuntimeErrorIsThrown);
+
+    // frame reuse
+    CALL_TEST_TIMED(PixelSum_Rebuild_Test, GivenNewFrames_WhenRebuild_ThenFreshBuildResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Rebuild_Test, GivenSameDimensions_WhenRebuild_ThenNothingIsAllocated);
+    CALL_TEST_TIMED(PixelSum_Rebuild_Test, GivenTooSmallBuffer_WhenRebuild_ThenRuntimeErrorIsThrown);
+
+    // dense box filter
+    CALL_TEST_TIMED(PixelSum_BoxFilter_Test, GivenRadius_WhenBoxFilter_ThenPerCallResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_BoxFilter_Test, GivenInvalidArguments_WhenBoxFilter_ThenRuntimeErrorIsThrown);
+
+    // grid aggregation
+    CALL_TEST_TIMED(PixelSum_Grid_Test, GivenCellsAndLevels_WhenGridFilter_ThenPerCellResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Grid_Test, GivenInvalidArguments_WhenGridFilter_ThenRuntimeErrorIsThrown);
+
+    // table files
+    CALL_TEST_TIMED(PixelSum_File_Test, GivenSavedTables_WhenLoad_ThenSavedResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_File_Test, GivenPartialTables_WhenSaveAndLoad_ThenOnlySavedTablesAreMapped);
+    CALL_TEST_TIMED(PixelSum_File_Test, GivenMismatchedFile_WhenLoad_ThenRuntimeErrorIsThrown);
+
+    // streaming construction
+    CALL_TEST_TIMED(PixelSum_Stream_Test, GivenPushedRows_WhenQueryArrivedRows_ThenFullBuildResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Stream_Test, GivenRingCapacity_WhenPushManyRows_ThenRecentWindowsStayExact);
+
+    // variance
+    CALL_TEST_TIMED(PixelSum_Variance_Test, GivenRandomWindows_WhenGetVariance_ThenTwoPassResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Variance_Test, GivenNoSquaresTable_WhenGetVariance_ThenRuntimeErrorIsThrown);
+
+    // rotated windows
+    CALL_TEST_TIMED(PixelSum_Rotated_Test, GivenTiltedWindows_WhenGetRotatedSum_ThenBruteForceSumsAreReturned);
+
+    // integral histograms
+    CALL_TEST_TIMED(PixelSum_Histogram_Test, GivenRandomWindows_WhenGetHistogram_ThenBruteForceCountsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Histogram_Test, GivenSingleValueBins_WhenGetPercentile_ThenSortedPixelsAreReturned);
+
+    // usage counters
+    CALL_TEST_TIMED(PixelSum_Stats_Test, GivenQueriesOnSeveralThreads_WhenReadCounters_ThenEveryQueryIsCounted);
+    CALL_TEST_TIMED(PixelSum_Stats_Test, GivenVarianceQueries_WhenReadCounters_ThenEachQueryIsCountedOnce);
+    CALL_TEST_TIMED(PixelSum_Stats_Test, GivenHistogramAndRotatedQueries_WhenReadCounters_ThenEachQueryIsCountedOnce);
+
+    // fixed dimensions and unchecked getters
+    CALL_TEST_TIMED(PixelSum_Fixed_Test, GivenFixedPatch_WhenCallGetters_ThenRuntimeDimensionResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Fixed_Test, GivenValidWindows_WhenCallUncheckedGetters_ThenCheckedResultsAreReturned);
+
+    // interleaved channels
+    CALL_TEST_TIMED(PixelSum_Channels_Test, GivenInterleavedPixels_WhenCallGetters_ThenPerPlaneResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Channels_Test, GivenInvalidArguments_WhenContructionOrQuery_ThenRuntimeErrorIsThrown);
+
+    // pitched images and regions of interest
+    CALL_TEST_TIMED(PixelSum_Image_Test, GivenPitchedRegion_WhenContruction_ThenPackedBuildResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Image_Test, GivenInvalidImage_WhenContruction_ThenRuntimeErrorIsThrown);
+
+    // lazy and partial tables
+    CALL_TEST_TIMED(PixelSum_Tables_Test, GivenPartialTables_WhenCallGetters_ThenFullBuildResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Tables_Test, GivenLazyObject_WhenQueryOnSeveralThreads_ThenEagerResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_Tables_Test, GivenLazyObjectWithOptionalTables_WhenTheyAreNotQueried_ThenTheyAreNeverBuilt);
+
+    // snapshot publication
+    CALL_TEST_TIMED(PixelSum_Snapshots_Test, GivenPublishingWriter_WhenReadersQuery_ThenEverySnapshotIsConsistent);
+    CALL_TEST_TIMED(PixelSum_Snapshots_Test, GivenPinnedSnapshot_WhenPublish_ThenItIsKeptAndOthersAreRecycled);
+
+    // batch construction
+    CALL_TEST_TIMED(PixelSum_BatchBuild_Test, GivenManyPatches_WhenBatchContruction_ThenPixelSumResultsAreReturned);
+    CALL_TEST_TIMED(PixelSum_BatchBuild_Test, GivenBatch_WhenRebuild_ThenArenaIsReused);
+    CALL_TEST_TIMED(PixelSum_BatchBuild_Test, GivenThreadedBatch_WhenRebuild_ThenWorkersAreReused);
+
     return 0;
 }
\ No newline at end of file